@@ -0,0 +1,112 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "budget.h"
+#include "main.h"
+#include "ini_parser.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BUDGET_MAX_BACKOFF 6 ///< intervals are stretched at most 64 times
+#define BUDGET_WINDOW_MS 1000
+
+static struct {
+	struct runs_list *runs;
+	unsigned runs_count;
+	long window_start; ///< start of the current global accounting window
+	unsigned long window_us; ///< cost charged in the current window
+	unsigned long windows_exceeded; ///< windows in which the global budget was exceeded
+} g_budget = {.runs = NULL, .runs_count = 0, .window_start = 0, .window_us = 0, .windows_exceeded = 0};
+
+static inline unsigned long elapsed_us(const struct timespec *start, const struct timespec *end) {
+	return (unsigned long)((end->tv_sec - start->tv_sec) * 1000000L + (end->tv_nsec - start->tv_nsec) / 1000);
+}
+
+void budget_init(struct runs_list *runs) {
+	g_budget.runs = runs;
+	g_budget.runs_count = (unsigned)(runs->runs_end - runs->runs_begin);
+}
+
+bool budget_recache(struct run_instance *run) {
+	struct timespec cpu_start, cpu_end, wall_start, wall_end;
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+	const bool changed = run->vtable->func_recache(run->data);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+	struct recache_cost *cost = &run->data->cost;
+	const unsigned long cpu = elapsed_us(&cpu_start, &cpu_end);
+	const unsigned long wall = elapsed_us(&wall_start, &wall_end);
+	cost->cpu_us += cpu;
+	cost->wall_us += wall;
+	cost->count++;
+	// a recache on the main thread stalls everything for its whole wall time
+	cost->last_us = (run->vtable->recache_blocking || cpu > wall) ? cpu : wall;
+	return changed;
+}
+
+long budget_interval(const struct run_instance *run, long interval) {
+	return interval << run->data->cost.backoff;
+}
+
+void budget_charge(struct run_instance *run, long now) {
+	struct cmd_data_base *data = run->data;
+	struct recache_cost *cost = &data->cost;
+	if (now - g_budget.window_start >= BUDGET_WINDOW_MS) {
+		g_budget.window_start = now;
+		g_budget.window_us = 0;
+	}
+	const unsigned long global_us = (unsigned long)g_general_settings.cpu_budget * 1000;
+	const bool global_exceeded = global_us > 0 && g_budget.window_us <= global_us && g_budget.window_us + cost->last_us > global_us;
+	g_budget.window_us += cost->last_us;
+	if (global_exceeded)
+		g_budget.windows_exceeded++;
+	if (data->interval <= 0) // can't be backed off
+		return;
+
+	const unsigned long rate = cost->last_us * 1000 / (unsigned long)budget_interval(run, data->interval); // microseconds per second
+	const unsigned long block_us = (unsigned long)data->cpu_budget * 1000;
+	bool over = block_us > 0 && rate > block_us;
+	if (global_us > 0 && g_budget.window_us > global_us)
+		over |= rate > global_us / g_budget.runs_count; // only the blocks above their fair share
+	if (over) {
+		if (cost->backoff < BUDGET_MAX_BACKOFF) {
+			cost->backoff++;
+			cost->throttled++;
+		}
+	} else if (cost->backoff > 0 && (block_us == 0 || rate * 2 <= block_us) &&
+			(global_us == 0 || g_budget.window_us * 2 <= global_us)) // would still fit with half the interval
+		cost->backoff--;
+}
+
+void budget_stats_print(void) {
+	if (!g_budget.runs)
+		return;
+	if (g_general_settings.cpu_budget > 0)
+		fprintf(stderr, "stats: cpu_budget windows_exceeded=%lu\n", g_budget.windows_exceeded);
+	FOREACH_RUN(run, g_budget.runs) {
+		const struct recache_cost *cost = &run->data->cost;
+		if (cost->count == 0)
+			continue;
+		fprintf(stderr, "stats: %s:%s recaches=%lu cpu_avg=%luus wall_avg=%luus throttled=%lu backoff=x%u%s\n",
+				run->vtable->name, run->instance ? run->instance : "", cost->count,
+				cost->cpu_us / cost->count, cost->wall_us / cost->count,
+				cost->throttled, 1U << cost->backoff, cost->backoff > 0 ? " [throttled]" : "");
+	}
+}
@@ -0,0 +1,54 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdbool.h>
+
+struct run_instance;
+struct runs_list;
+
+/**
+ * @brief budget_init remember the blocks, for printing their costs in the stats
+ */
+void budget_init(struct runs_list *runs);
+/**
+ * @brief budget_recache run the recache of @arg run and measure its cost
+ *
+ * Measures the CPU time (CLOCK_THREAD_CPUTIME_ID) and wall time spent in
+ * func_recache into cmd_data_base::cost. Safe to call from a worker thread.
+ *
+ * @return the result of func_recache
+ */
+bool budget_recache(struct run_instance *run);
+/**
+ * @brief budget_charge account the cost of the last recache of @arg run against the budgets
+ *
+ * Must be called from the main thread. If the block exceeds its own
+ * cpu_budget, or the global cpu_budget is exceeded while the block is above
+ * its fair share, the block's interval is backed off. Once it fits again,
+ * the back off is gradually undone.
+ */
+void budget_charge(struct run_instance *run, long now);
+/**
+ * @brief budget_interval get the interval of the block after its back off
+ */
+long budget_interval(const struct run_instance *run, long interval);
+void budget_stats_print(void);
+
+#endif // BUDGET_H
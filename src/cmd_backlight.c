@@ -17,6 +17,7 @@
 
 #include "main.h"
 #include "vprint.h"
+#include "read_batch.h"
 
 #include <string.h>
 #include <alloca.h>
@@ -36,6 +37,8 @@ struct cmd_backlight_data {
 	long max_brightness;
 	long wheel_step;
 	bool supports_changing;
+	struct read_batch rb;
+	char read_buf[64];
 	char cached_output[128];
 };
 
@@ -86,6 +89,8 @@ static bool cmd_backlight_init(struct cmd_data_base *_data) {
 
 	data->backlight_fd = openat(dir_fd, "brightness", data->supports_changing ? O_RDWR : O_RDONLY);
 	close(dir_fd);
+	read_batch_init(&data->rb, data->backlight_fd, data->read_buf, sizeof(data->read_buf) - 1);
+	data->base.read_batch = &data->rb;
 	return data->backlight_fd >= 0;
 }
 
@@ -98,65 +103,73 @@ static void cmd_backlight_destroy(struct cmd_data_base *_data) {
 // generated using command ./scripts/gen-format.py vV
 VPRINT_OPTS(cmd_backlight_var_options, {0x00000000, 0x00000000, 0x00400000, 0x00400000});
 
-static void cmd_backlight_update_text(struct cmd_backlight_data *data, long value) {
-	if (likely(value >= 0)) {
-		const int brightness = (int)((value * 100 + data->max_brightness / 2) / data->max_brightness);
-		struct vprint ctx = {cmd_backlight_var_options, data->format, data->cached_output, data->cached_output + sizeof(data->cached_output)};
-		while (vprint_walk(&ctx) != 0) {
-			vprint_itoa(&ctx, brightness);
-		}
+static bool cmd_backlight_update_text(struct cmd_backlight_data *data, long value) {
+	if (unlikely(value < 0))
+		return false;
+	const int brightness = (int)((value * 100 + data->max_brightness / 2) / data->max_brightness);
+	char buffer[sizeof(data->cached_output)];
+	struct vprint ctx = VPRINT_INIT(cmd_backlight_var_options, data->format, buffer);
+	while (vprint_walk(&ctx) != 0) {
+		vprint_itoa(&ctx, brightness);
 	}
+	return CMD_TEXT_SET(data, buffer, (size_t)(ctx.buffer_start - buffer));
 }
 
-static void cmd_backlight_recache(struct cmd_data_base *_data) {
+static bool cmd_backlight_recache(struct cmd_data_base *_data) {
 	struct cmd_backlight_data *data = (struct cmd_backlight_data *)_data;
-	cmd_backlight_update_text(data, cmd_backlight_read_value(data->backlight_fd));
+	ssize_t len = read_batch_read(&data->rb);
+	if (unlikely(len <= 0))
+		return false;
+	data->read_buf[len] = '\0';
+	return cmd_backlight_update_text(data, atol(data->read_buf));
+}
+
+static void cmd_backlight_write_value(struct cmd_backlight_data *data, long new_value) {
+	char res[64];
+	int res_len = snprintf(res, sizeof(res), "%ld", new_value);
+	lseek(data->backlight_fd, 0, SEEK_SET);
+	if (likely(res_len == write(data->backlight_fd, res, (size_t)res_len)))
+		data->base.dirty |= cmd_backlight_update_text(data, new_value);
 }
 
 static void cmd_backlight_cevent(struct cmd_data_base *_data, unsigned event, unsigned modifiers) {
 	(void) modifiers;
 	struct cmd_backlight_data *data = (struct cmd_backlight_data *)_data;
 	if (data->supports_changing) {
-		long new_value;
 		switch (event) {
 			case CEVENT_MOUSE_LEFT:
-				new_value = 0;
+				cmd_backlight_write_value(data, 0);
 				break;
 			case CEVENT_MOUSE_RIGHT:
-				new_value = data->max_brightness;
+				cmd_backlight_write_value(data, data->max_brightness);
 				break;
-			case CEVENT_MOUSE_WHEEL_UP:
-			case CEVENT_MOUSE_WHEEL_DOWN: {
-				new_value = cmd_backlight_read_value(data->backlight_fd);
-				if (unlikely(new_value < 0))
-					return;
-
-				const long change = (data->wheel_step * data->max_brightness + (100 / 2)) / 100;
-				if (event == CEVENT_MOUSE_WHEEL_UP) {
-					new_value += change;
-					if (new_value > data->max_brightness)
-						new_value = data->max_brightness;
-				} else {
-					new_value -= change;
-					if (new_value < 0)
-						new_value = 0;
-				}
-				break;
-			}
-			default: return;
 		}
-		char res[64];
-		int res_len = snprintf(res, sizeof(res), "%ld", new_value);
-		lseek(data->backlight_fd, 0, SEEK_SET);
-		if (likely(res_len == write(data->backlight_fd, res, (size_t)res_len)))
-			cmd_backlight_update_text(data, new_value);
+	}
+}
+
+static void cmd_backlight_wheel(struct cmd_data_base *_data, int steps) {
+	struct cmd_backlight_data *data = (struct cmd_backlight_data *)_data;
+	if (data->supports_changing) {
+		long new_value = cmd_backlight_read_value(data->backlight_fd);
+		if (unlikely(new_value < 0))
+			return;
+
+		new_value += steps * ((data->wheel_step * data->max_brightness + (100 / 2)) / 100);
+		if (new_value > data->max_brightness)
+			new_value = data->max_brightness;
+		else if (new_value < 0)
+			new_value = 0;
+		cmd_backlight_write_value(data, new_value);
 	}
 }
 
 #define CPU_TEMP_OPTIONS(F) \
+	F("cpu_budget", OPT_TYPE_DURATION, offsetof(struct cmd_backlight_data, base.cpu_budget)), \
 	F("device", OPT_TYPE_STR, offsetof(struct cmd_backlight_data, device)), \
 	F("format", OPT_TYPE_STR, offsetof(struct cmd_backlight_data, format)), \
-	F("interval", OPT_TYPE_LONG, offsetof(struct cmd_backlight_data, base.interval)), \
+	F("interval", OPT_TYPE_DURATION, offsetof(struct cmd_backlight_data, base.interval)), \
+	F("max_interval", OPT_TYPE_DURATION, offsetof(struct cmd_backlight_data, base.max_interval)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_backlight_data, base.signal)), \
 	F("wheel_step", OPT_TYPE_LONG, offsetof(struct cmd_backlight_data, wheel_step)), \
 
 CMD_OPTS_GEN_STRUCTS(cmd_backlight, CPU_TEMP_OPTIONS)
@@ -170,5 +183,6 @@ DECLARE_CMD(cmd_backlight) = {
 	.func_init = cmd_backlight_init,
 	.func_destroy = cmd_backlight_destroy,
 	.func_recache = cmd_backlight_recache,
-	.func_cevent = cmd_backlight_cevent
+	.func_cevent = cmd_backlight_cevent,
+	.func_wheel = cmd_backlight_wheel
 };
@@ -17,8 +17,10 @@
 
 #include "main.h"
 #include "vprint.h"
+#include "read_batch.h"
 
 #include <alloca.h>
+#include <limits.h>
 #include <string.h>
 
 #include <sys/types.h>
@@ -41,6 +43,8 @@ struct cmd_battery_data {
 	long threshold_time;
 	long threshold_pct;
 
+	struct read_batch rb;
+	char read_buf[2048];
 	char cached_output[256];
 };
 
@@ -70,6 +74,8 @@ static bool cmd_battery_init(struct cmd_data_base *_data) {
 #undef BATTERY_PATH
 
 	data->bat_fd = open(path, O_RDONLY);
+	read_batch_init(&data->rb, data->bat_fd, data->read_buf, sizeof(data->read_buf) - 1);
+	data->base.read_batch = &data->rb;
 	return data->bat_fd >= 0;
 }
 
@@ -101,7 +107,7 @@ enum {
 	BAT_STS_FULL = 3,
 };
 
-__attribute__((always_inline)) inline bool cmd_battery_parse_file(int fd, struct battery_info_t *info) {
+__attribute__((always_inline)) inline bool cmd_battery_parse_file(struct read_batch *rb, struct battery_info_t *info) {
 	enum {
 		BAT_OPT_STATUS = 0,
 		BAT_OPT_INT = 1,
@@ -129,11 +135,13 @@ __attribute__((always_inline)) inline bool cmd_battery_parse_file(int fd, struct
 	};
 #undef BAT_OPT
 
-	char buffer[2048];
-	ssize_t buf_len;
+	char *const buffer = rb->buf;
+	ssize_t len = read_batch_read(rb);
+	off_t pos = 0;
 	unsigned offset = 0;
-	lseek(fd, 0, SEEK_SET);
-	while (0 < (buf_len = offset + read(fd, buffer + offset, sizeof(buffer) - 1 - offset))) {
+	while (0 < len) {
+		pos += len;
+		const ssize_t buf_len = offset + len;
 		buffer[buf_len] = '\0';
 		char *start = buffer;
 		while (true) {
@@ -175,6 +183,7 @@ __attribute__((always_inline)) inline bool cmd_battery_parse_file(int fd, struct
 		}
 		offset = (unsigned)(buffer + buf_len - start);
 		memmove(buffer, start, offset);
+		len = pread(rb->fd, buffer + offset, rb->size - offset, pos);
 	}
 	return true;
 }
@@ -182,7 +191,7 @@ __attribute__((always_inline)) inline bool cmd_battery_parse_file(int fd, struct
 // generated using command ./scripts/gen-format.py bBt
 VPRINT_OPTS(cmd_battery_var_options, {0x00000000, 0x00000000, 0x00000004, 0x00100004});
 
-static void cmd_battery_recache(struct cmd_data_base *_data) {
+static bool cmd_battery_recache(struct cmd_data_base *_data) {
 	struct cmd_battery_data *data = (struct cmd_battery_data *)_data;
 
 	struct battery_info_t info = {BAT_STS_DISCHARGIUNG, -1, -1, -1, -1, -1, -1};
@@ -190,7 +199,7 @@ static void cmd_battery_recache(struct cmd_data_base *_data) {
 
 	/* read file */
 	{
-		if (cmd_battery_parse_file(data->bat_fd, &info)) {
+		if (cmd_battery_parse_file(&data->rb, &info)) {
 			full_design = data->last_full_capacity ? info.full_design_capacity : info.full_design_design;
 			if (info.remainingW < 0)
 				info.remainingW = info.remainingAh;
@@ -211,14 +220,28 @@ static void cmd_battery_recache(struct cmd_data_base *_data) {
 		remaining_time = val * 60  / info.present_rate;
 	}
 
+	if (info.status == BAT_STS_DISCHARGIUNG && info.present_rate > 0) {
+		// recache right when a threshold is crossed, even if the interval is long
+		const long until_pct = (long)((info.remainingW - full_design * data->threshold_pct / 100.0) * 3600000.0 / info.present_rate);
+		const long until_time = (remaining_time - data->threshold_time) * 60000L;
+		long until = LONG_MAX;
+		if (until_pct > 0)
+			until = until_pct;
+		if (until_time > 0 && until_time < until)
+			until = until_time;
+		if (until != LONG_MAX)
+			data->base.next_update = until;
+	}
+
+	bool changed;
 	if (info.status == BAT_STS_FULL)
-		CMD_COLOR_SET(data, g_general_settings.color_good);
+		changed = CMD_COLOR_SET(data, g_general_settings.color_good);
 	else if (info.status == BAT_STS_CHARGIUNG)
-		CMD_COLOR_SET(data, g_general_settings.color_degraded);
+		changed = CMD_COLOR_SET(data, g_general_settings.color_degraded);
 	else if (info.status == BAT_STS_DISCHARGIUNG && (remaining_pct < (int)data->threshold_pct || remaining_time < data->threshold_time))
-		CMD_COLOR_SET(data, g_general_settings.color_bad);
+		changed = CMD_COLOR_SET(data, g_general_settings.color_bad);
 	else
-		CMD_COLOR_CLEAN(data);
+		changed = CMD_COLOR_CLEAN(data);
 
 	/* Static check for format relative position */
 	{
@@ -233,7 +256,8 @@ _Static_assert(offsetof(struct cmd_battery_data, field) - offsetof(struct cmd_ba
 	}
 	const char *output_format = *(&data->format_missing + info.status);
 	unsigned res;
-	struct vprint ctx = {cmd_battery_var_options, output_format, data->cached_output, data->cached_output + sizeof(data->cached_output)};
+	char buffer[sizeof(data->cached_output)];
+	struct vprint ctx = VPRINT_INIT(cmd_battery_var_options, output_format, buffer);
 	while ((res = vprint_walk(&ctx)) != 0) {
 		switch (res) {
 			case 'b':
@@ -247,16 +271,21 @@ _Static_assert(offsetof(struct cmd_battery_data, field) - offsetof(struct cmd_ba
 				break;
 		}
 	}
+	changed |= CMD_TEXT_SET(data, buffer, (size_t)(ctx.buffer_start - buffer));
+	return changed;
 }
 
 #define BAT_OPTIONS(F) \
+	F("cpu_budget", OPT_TYPE_DURATION, offsetof(struct cmd_battery_data, base.cpu_budget)), \
 	F("device", OPT_TYPE_STR, offsetof(struct cmd_battery_data, device)), \
 	F("format_charging", OPT_TYPE_STR, offsetof(struct cmd_battery_data, format_charging)), \
 	F("format_discharging", OPT_TYPE_STR, offsetof(struct cmd_battery_data, format_discharging)), \
 	F("format_full", OPT_TYPE_STR, offsetof(struct cmd_battery_data, format_full)), \
 	F("format_missing", OPT_TYPE_STR, offsetof(struct cmd_battery_data, format_missing)), \
-	F("interval", OPT_TYPE_LONG, offsetof(struct cmd_battery_data, base.interval)), \
+	F("interval", OPT_TYPE_DURATION, offsetof(struct cmd_battery_data, base.interval)), \
 	F("last_full_capacity", OPT_TYPE_LONG, offsetof(struct cmd_battery_data, last_full_capacity)), \
+	F("max_interval", OPT_TYPE_DURATION, offsetof(struct cmd_battery_data, base.max_interval)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_battery_data, base.signal)), \
 	F("threshold_pct", OPT_TYPE_LONG, offsetof(struct cmd_battery_data, threshold_pct)), \
 	F("threshold_time", OPT_TYPE_LONG, offsetof(struct cmd_battery_data, threshold_time)), \
 
@@ -17,6 +17,7 @@
 
 #include "main.h"
 #include "vprint.h"
+#include "read_batch.h"
 
 #include <string.h>
 #include <alloca.h>
@@ -33,6 +34,8 @@ struct cmd_cpu_temperature_data {
 		int thermal_fd;
 	};
 	long high_threshold;
+	struct read_batch rb;
+	char read_buf[64];
 	char cached_output[128];
 };
 
@@ -58,6 +61,8 @@ static bool cmd_cpu_temperature_init(struct cmd_data_base *_data) {
 #undef THERMAL_PATH
 
 	data->thermal_fd = open(path, O_RDONLY);
+	read_batch_init(&data->rb, data->thermal_fd, data->read_buf, sizeof(data->read_buf) - 1);
+	data->base.read_batch = &data->rb;
 	return data->thermal_fd >= 0;
 }
 
@@ -70,13 +75,13 @@ static void cmd_cpu_temperature_destroy(struct cmd_data_base *_data) {
 // generated using command ./scripts/gen-format.py cf
 VPRINT_OPTS(cmd_cpu_temperature_var_options, {0x00000000, 0x00000000, 0x00000000, 0x00000048});
 
-static void cmd_cpu_temperature_recache(struct cmd_data_base *_data) {
+static bool cmd_cpu_temperature_recache(struct cmd_data_base *_data) {
 	struct cmd_cpu_temperature_data *data = (struct cmd_cpu_temperature_data *)_data;
 
 	int curr_value = -1;
 	{
-		char buf[64];
-		ssize_t len = pread(data->thermal_fd, buf, sizeof(buf) - 1, 0);
+		char *const buf = data->read_buf;
+		ssize_t len = read_batch_read(&data->rb);
 		if (likely(len > 0)) {
 			buf[len] = '\0';
 			curr_value = atoi(buf) / 1000;
@@ -84,7 +89,8 @@ static void cmd_cpu_temperature_recache(struct cmd_data_base *_data) {
 	}
 
 	unsigned res;
-	struct vprint ctx = {cmd_cpu_temperature_var_options, data->format, data->cached_output, data->cached_output + sizeof(data->cached_output)};
+	char buffer[sizeof(data->cached_output)];
+	struct vprint ctx = VPRINT_INIT(cmd_cpu_temperature_var_options, data->format, buffer);
 	while ((res = vprint_walk(&ctx)) != 0) {
 		if (unlikely(curr_value == -1))
 			vprint_strcat(&ctx, "???");
@@ -95,17 +101,22 @@ static void cmd_cpu_temperature_recache(struct cmd_data_base *_data) {
 			vprint_itoa(&ctx, output);
 		}
 	}
+	bool changed = CMD_TEXT_SET(data, buffer, (size_t)(ctx.buffer_start - buffer));
 	if (data->high_threshold > 0 && data->high_threshold < curr_value)
-		CMD_COLOR_SET(data, g_general_settings.color_bad);
+		changed |= CMD_COLOR_SET(data, g_general_settings.color_bad);
 	else
-		CMD_COLOR_CLEAN(data);
+		changed |= CMD_COLOR_CLEAN(data);
+	return changed;
 }
 
 #define CPU_TEMP_OPTIONS(F) \
+	F("cpu_budget", OPT_TYPE_DURATION, offsetof(struct cmd_cpu_temperature_data, base.cpu_budget)), \
 	F("device", OPT_TYPE_STR, offsetof(struct cmd_cpu_temperature_data, device)), \
 	F("format", OPT_TYPE_STR, offsetof(struct cmd_cpu_temperature_data, format)), \
 	F("high_threshold", OPT_TYPE_LONG, offsetof(struct cmd_cpu_temperature_data, high_threshold)), \
-	F("interval", OPT_TYPE_LONG, offsetof(struct cmd_cpu_temperature_data, base.interval)), \
+	F("interval", OPT_TYPE_DURATION, offsetof(struct cmd_cpu_temperature_data, base.interval)), \
+	F("max_interval", OPT_TYPE_DURATION, offsetof(struct cmd_cpu_temperature_data, base.max_interval)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_cpu_temperature_data, base.signal)), \
 
 CMD_OPTS_GEN_STRUCTS(cmd_cpu_temperature, CPU_TEMP_OPTIONS)
 
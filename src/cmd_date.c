@@ -53,7 +53,7 @@ static void cmd_date_destroy(struct cmd_data_base *_data) {
 	free(data->timezone);
 }
 
-static void cmd_date_recache(struct cmd_data_base *_data) {
+static bool cmd_date_recache(struct cmd_data_base *_data) {
 	struct cmd_date_data *data = (struct cmd_date_data *)_data;
 
 	if (data->timezone != g_curr_tz) {
@@ -66,13 +66,17 @@ static void cmd_date_recache(struct cmd_data_base *_data) {
 	}
 
 	struct tm tm;
-	time_t t = time(NULL);
-	localtime_r(&t, &tm);
-	strftime(data->cached_output, sizeof(data->cached_output), data->format, &tm);
+	struct timespec ts; // time() is tick based, so it might lag behind our second aligned wakeups
+	clock_gettime(CLOCK_REALTIME, &ts);
+	localtime_r(&ts.tv_sec, &tm);
+	char buffer[sizeof(data->cached_output)];
+	const size_t len = strftime(buffer, sizeof(buffer), data->format, &tm);
+	return CMD_TEXT_SET(data, buffer, len);
 }
 
 #define DATE_OPTIONS(F) \
 	F("format", OPT_TYPE_STR, offsetof(struct cmd_date_data, format)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_date_data, base.signal)), \
 	F("timezone", OPT_TYPE_STR, offsetof(struct cmd_date_data, timezone))
 
 CMD_OPTS_GEN_STRUCTS(cmd_date, DATE_OPTIONS)
@@ -55,14 +55,16 @@ static void cmd_disk_usage_destroy(struct cmd_data_base *_data) {
 // generated using command ./scripts/gen-format.py aAfFtuU
 VPRINT_OPTS(cmd_disk_usage_var_options, {0x00000000, 0x00000000, 0x00200042, 0x00300042});
 
-static void cmd_disk_usage_recache(struct cmd_data_base *_data) {
+static bool cmd_disk_usage_recache(struct cmd_data_base *_data) {
 	struct cmd_disk_usage_data *data = (struct cmd_disk_usage_data *)_data;
 
 	struct statvfs buf;
 	unsigned res;
+	bool changed = false;
 
 	if (statvfs(data->vfs_path, &buf) == 0) {
-		struct vprint ctx = {cmd_disk_usage_var_options, data->format, data->cached_output, data->cached_output + sizeof(data->cached_output)};
+		char buffer[sizeof(data->cached_output)];
+		struct vprint ctx = VPRINT_INIT(cmd_disk_usage_var_options, data->format, buffer);
 		while ((res = vprint_walk(&ctx)) != 0) {
 			uint64_t value = 0;
 			switch (res | 0x20) { // convert to lower case
@@ -74,22 +76,28 @@ static void cmd_disk_usage_recache(struct cmd_data_base *_data) {
 			}
 			vprint_human_bytes(&ctx, value, ((res & 0x20) == 0 ? (uint64_t)buf.f_blocks : 0), (uint64_t)buf.f_bsize, data->use_decimal);
 		}
+		changed = CMD_TEXT_SET(data, buffer, (size_t)(ctx.buffer_start - buffer));
 #define DISK_THRESHOLD_CMP(threshold) ((threshold) >= 0 ? (buf.f_bfree * buf.f_blocks < (uint64_t)(threshold)) : buf.f_bfree * 100 < (uint64_t)(-(threshold)) * buf.f_blocks )
 		if (DISK_THRESHOLD_CMP(data->threshold_critical))
-			CMD_COLOR_SET(data, g_general_settings.color_bad);
+			changed |= CMD_COLOR_SET(data, g_general_settings.color_bad);
 		else if (DISK_THRESHOLD_CMP(data->threshold_degraded))
-			CMD_COLOR_SET(data, g_general_settings.color_degraded);
+			changed |= CMD_COLOR_SET(data, g_general_settings.color_degraded);
 		else
-			CMD_COLOR_CLEAN(data);
+			changed |= CMD_COLOR_CLEAN(data);
 	}
+	return changed;
 }
 
 #define DISK_USAGE_OPTIONS(F) \
+	F("cpu_budget", OPT_TYPE_DURATION, offsetof(struct cmd_disk_usage_data, base.cpu_budget)), \
 	F("format", OPT_TYPE_STR, offsetof(struct cmd_disk_usage_data, format)), \
-	F("interval", OPT_TYPE_LONG, offsetof(struct cmd_disk_usage_data, base.interval)), \
+	F("interval", OPT_TYPE_DURATION, offsetof(struct cmd_disk_usage_data, base.interval)), \
+	F("max_interval", OPT_TYPE_DURATION, offsetof(struct cmd_disk_usage_data, base.max_interval)), \
 	F("path", OPT_TYPE_STR, offsetof(struct cmd_disk_usage_data, vfs_path)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_disk_usage_data, base.signal)), \
 	F("threshold_critical", OPT_TYPE_BYTE_THRESHOLD, offsetof(struct cmd_disk_usage_data, threshold_critical)), \
 	F("threshold_degraded", OPT_TYPE_BYTE_THRESHOLD, offsetof(struct cmd_disk_usage_data, threshold_degraded)), \
+	F("timeout", OPT_TYPE_DURATION, offsetof(struct cmd_disk_usage_data, base.timeout)), \
 	F("use_decimal", OPT_TYPE_LONG, offsetof(struct cmd_disk_usage_data, use_decimal))
 
 CMD_OPTS_GEN_STRUCTS(cmd_disk_usage, DISK_USAGE_OPTIONS)
@@ -102,5 +110,6 @@ DECLARE_CMD(cmd_disk_usage) = {
 
 	.func_init = cmd_disk_usage_init,
 	.func_destroy = cmd_disk_usage_destroy,
-	.func_recache = cmd_disk_usage_recache
+	.func_recache = cmd_disk_usage_recache,
+	.recache_blocking = true // statvfs hangs on dead network mounts
 };
@@ -43,7 +43,7 @@ static bool cmd_eth_init(struct cmd_data_base *_data) {
 	data->base.cached_fulltext = data->cached_output;
 	data->base.interval = -1;
 
-	data->if_pos = net_add_if(data->interface);
+	data->if_pos = net_add_if(data->interface, &data->base);
 	// data->interface is used in inner networking array
 
 	return data->if_pos != NET_ADD_IF_FAILED;
@@ -59,7 +59,7 @@ static void cmd_eth_destroy(struct cmd_data_base *_data) {
 // generated using command ./scripts/gen-format.py Aa46
 VPRINT_OPTS(cmd_eth_var_options, {0x00000000, 0x00500000, 0x00000002, 0x00000002});
 
-static void cmd_eth_recache(struct cmd_data_base *_data) {
+static bool cmd_eth_recache(struct cmd_data_base *_data) {
 	struct cmd_eth_data *data = (struct cmd_eth_data *)_data;
 
 	struct net_if_addrs *curr_if = g_net_global.ifs_arr + data->if_pos;
@@ -67,7 +67,8 @@ static void cmd_eth_recache(struct cmd_data_base *_data) {
 
 	bool noIP = false;
 	unsigned res;
-	struct vprint ctx = {cmd_eth_var_options, output_format, data->cached_output, data->cached_output + sizeof(data->cached_output)};
+	char buffer[sizeof(data->cached_output)];
+	struct vprint ctx = VPRINT_INIT(cmd_eth_var_options, output_format, buffer);
 	while ((res = vprint_walk(&ctx)) != 0) {
 		const char *addr = NULL;
 		switch (res) {
@@ -94,18 +95,21 @@ static void cmd_eth_recache(struct cmd_data_base *_data) {
 		}
 		vprint_strcat(&ctx, addr);
 	}
+	bool changed = CMD_TEXT_SET(data, buffer, (size_t)(ctx.buffer_start - buffer));
 	if (curr_if->is_down)
-		CMD_COLOR_SET(data, g_general_settings.color_bad);
+		changed |= CMD_COLOR_SET(data, g_general_settings.color_bad);
 	else if (noIP)
-		CMD_COLOR_SET(data, g_general_settings.color_degraded);
+		changed |= CMD_COLOR_SET(data, g_general_settings.color_degraded);
 	else
-		CMD_COLOR_SET(data, g_general_settings.color_good);
+		changed |= CMD_COLOR_SET(data, g_general_settings.color_good);
+	return changed;
 }
 
 #define ETH_OPTIONS(F) \
 	F("format_down", OPT_TYPE_STR, offsetof(struct cmd_eth_data, format_down)), \
 	F("format_up", OPT_TYPE_STR, offsetof(struct cmd_eth_data, format_up)), \
-	F("interface", OPT_TYPE_STR, offsetof(struct cmd_eth_data, interface))
+	F("interface", OPT_TYPE_STR, offsetof(struct cmd_eth_data, interface)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_eth_data, base.signal))
 
 CMD_OPTS_GEN_STRUCTS(cmd_eth, ETH_OPTIONS)
 
@@ -17,6 +17,7 @@
 
 #include "main.h"
 #include "vprint.h"
+#include "read_batch.h"
 
 #include <string.h>
 
@@ -28,6 +29,8 @@ struct cmd_load_data {
 	struct cmd_data_base base;
 	char *format;
 	int fd;
+	struct read_batch rb;
+	char read_buf[65];
 	char cached_output[256];
 };
 
@@ -37,6 +40,8 @@ static bool cmd_load_init(struct cmd_data_base *_data) {
 		return false;
 	data->base.cached_fulltext = data->cached_output;
 	data->fd = open("/proc/loadavg", O_RDONLY);
+	read_batch_init(&data->rb, data->fd, data->read_buf, sizeof(data->read_buf) - 1);
+	data->base.read_batch = &data->rb;
 	return data->fd >= 0;
 }
 
@@ -49,31 +54,37 @@ static void cmd_load_destroy(struct cmd_data_base *_data) {
 // generated using command ./scripts/gen-format.py 123
 VPRINT_OPTS(cmd_load_var_options, {0x00000000, 0x000E0000, 0x00000000, 0x00000000});
 
-static void cmd_load_recache(struct cmd_data_base *_data) {
+static bool cmd_load_recache(struct cmd_data_base *_data) {
 	struct cmd_load_data *data = (struct cmd_load_data *)_data;
 
-	char buf[65];
-	ssize_t len = pread(data->fd, buf, sizeof(buf) - 1, 0);
-	if (likely(len > 0)) {
-		buf[len] = '\0';
-		const char *loadavgs[3] = {NULL, NULL, NULL};
-		char *tmp = buf;
-		for (unsigned i = 0; i < 3; i++) {
-			loadavgs[i] = tmp;
-			tmp = strchr(tmp, ' ');
-			*(tmp++) = '\0';
-		}
-		unsigned res;
-		struct vprint ctx = {cmd_load_var_options, data->format, data->cached_output, data->cached_output + sizeof(data->cached_output)};
-		while ((res = vprint_walk(&ctx)) != 0) {
-			vprint_strcat(&ctx, loadavgs[res - '1']);
-		}
+	char *const buf = data->read_buf;
+	ssize_t len = read_batch_read(&data->rb);
+	if (unlikely(len <= 0))
+		return false;
+
+	buf[len] = '\0';
+	const char *loadavgs[3] = {NULL, NULL, NULL};
+	char *tmp = buf;
+	for (unsigned i = 0; i < 3; i++) {
+		loadavgs[i] = tmp;
+		tmp = strchr(tmp, ' ');
+		*(tmp++) = '\0';
+	}
+	unsigned res;
+	char buffer[sizeof(data->cached_output)];
+	struct vprint ctx = VPRINT_INIT(cmd_load_var_options, data->format, buffer);
+	while ((res = vprint_walk(&ctx)) != 0) {
+		vprint_strcat(&ctx, loadavgs[res - '1']);
 	}
+	return CMD_TEXT_SET(data, buffer, (size_t)(ctx.buffer_start - buffer));
 }
 
 #define LOAD_OPTIONS(F) \
+	F("cpu_budget", OPT_TYPE_DURATION, offsetof(struct cmd_load_data, base.cpu_budget)), \
 	F("format", OPT_TYPE_STR, offsetof(struct cmd_load_data, format)), \
-	F("interval", OPT_TYPE_LONG, offsetof(struct cmd_load_data, base.interval)), \
+	F("interval", OPT_TYPE_DURATION, offsetof(struct cmd_load_data, base.interval)), \
+	F("max_interval", OPT_TYPE_DURATION, offsetof(struct cmd_load_data, base.max_interval)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_load_data, base.signal)), \
 
 CMD_OPTS_GEN_STRUCTS(cmd_load, LOAD_OPTIONS)
 
@@ -17,6 +17,7 @@
 
 #include "main.h"
 #include "vprint.h"
+#include "read_batch.h"
 
 #include <string.h>
 
@@ -28,6 +29,7 @@ struct cmd_memory_data {
 	struct cmd_data_base base;
 
 	int fd;
+	struct read_batch rb;
 	char *format;
 
 	long use_decimal;
@@ -35,6 +37,7 @@ struct cmd_memory_data {
 	long threshold_degraded;
 	long threshold_critical;
 
+	char read_buf[2048];
 	char cached_output[256];
 };
 
@@ -49,6 +52,8 @@ static bool cmd_memory_init(struct cmd_data_base *_data) {
 	data->base.cached_fulltext = data->cached_output;
 
 	data->fd = open("/proc/meminfo", O_RDONLY);
+	read_batch_init(&data->rb, data->fd, data->read_buf, sizeof(data->read_buf) - 1);
+	data->base.read_batch = &data->rb;
 	return data->fd >= 0;
 }
 
@@ -67,7 +72,7 @@ struct memory_info_t {
 	int64_t ram_shared;
 } __attribute__ ((aligned (sizeof(int64_t))));
 
-__attribute__((always_inline)) inline bool cmd_memory_file(struct memory_info_t *info, int fd) {
+__attribute__((always_inline)) inline bool cmd_memory_file(struct memory_info_t *info, struct read_batch *rb) {
 #define MEM_OPT(str, field) {str, X_STRLEN(str), offsetof(struct memory_info_t, field) / sizeof(uint64_t)}
 	static const struct {
 		// 14 is the longest("MemAvailable:") + 1
@@ -85,11 +90,13 @@ __attribute__((always_inline)) inline bool cmd_memory_file(struct memory_info_t
 	};
 #undef MEM_OPT
 
-	char buffer[2048];
-	ssize_t buf_len;
+	char *const buffer = rb->buf;
+	ssize_t len = read_batch_read(rb);
+	off_t pos = 0;
 	unsigned offset = 0, found = 0;
-	lseek(fd, 0, SEEK_SET);
-	while (0 < (buf_len = offset + read(fd, buffer + offset, sizeof(buffer) - 1 - offset))) {
+	while (0 < len) {
+		pos += len;
+		const ssize_t buf_len = offset + len;
 		buffer[buf_len] = '\0';
 		char *start = buffer;
 		while (true) {
@@ -113,6 +120,7 @@ __attribute__((always_inline)) inline bool cmd_memory_file(struct memory_info_t
 		}
 		offset = (unsigned)(buffer + buf_len - start);
 		memmove(buffer, start, offset);
+		len = pread(rb->fd, buffer + offset, rb->size - offset, pos);
 	}
 	return (found == ARRAY_SIZE(g_mem_opts));
 }
@@ -120,13 +128,15 @@ __attribute__((always_inline)) inline bool cmd_memory_file(struct memory_info_t
 // generated using command ./scripts/gen-format.py AaFfSstUu
 VPRINT_OPTS(cmd_memory_var_options, {0x00000000, 0x00000000, 0x00280042, 0x00380042});
 
-static void cmd_memory_recache(struct cmd_data_base *_data) {
+static bool cmd_memory_recache(struct cmd_data_base *_data) {
 	struct cmd_memory_data *data = (struct cmd_memory_data *)_data;
 
+	bool changed = false;
 	struct memory_info_t info = {0};
-	if (likely(cmd_memory_file(&info, data->fd))) {
+	if (likely(cmd_memory_file(&info, &data->rb))) {
 		unsigned res;
-		struct vprint ctx = {cmd_memory_var_options, data->format, data->cached_output, data->cached_output + sizeof(data->cached_output)};
+		char buffer[sizeof(data->cached_output)];
+		struct vprint ctx = VPRINT_INIT(cmd_memory_var_options, data->format, buffer);
 		while ((res = vprint_walk(&ctx)) != 0) {
 			int64_t value;
 			switch (res | 0x20) { // convert to lower case
@@ -142,20 +152,25 @@ static void cmd_memory_recache(struct cmd_data_base *_data) {
 			}
 			vprint_human_bytes(&ctx, (uint64_t)value, ((res & 0x20) == 0 ? (uint64_t)info.ram_total : 0), 1, data->use_decimal);
 		}
+		changed = CMD_TEXT_SET(data, buffer, (size_t)(ctx.buffer_start - buffer));
 #define MEM_THRESHOLD_CMP(threshold) (info.ram_free < ((threshold) >= 0 ? (threshold) : -(threshold) * info.ram_total / 100))
 
 		if (MEM_THRESHOLD_CMP(data->threshold_critical))
-			CMD_COLOR_SET(data, g_general_settings.color_bad);
+			changed |= CMD_COLOR_SET(data, g_general_settings.color_bad);
 		else if (MEM_THRESHOLD_CMP(data->threshold_degraded))
-			CMD_COLOR_SET(data, g_general_settings.color_degraded);
+			changed |= CMD_COLOR_SET(data, g_general_settings.color_degraded);
 		else
-			CMD_COLOR_CLEAN(data);
+			changed |= CMD_COLOR_CLEAN(data);
 	}
+	return changed;
 }
 
 #define MEMORY_OPTIONS(F) \
+	F("cpu_budget", OPT_TYPE_DURATION, offsetof(struct cmd_memory_data, base.cpu_budget)), \
 	F("format", OPT_TYPE_STR, offsetof(struct cmd_memory_data, format)), \
-	F("interval", OPT_TYPE_LONG, offsetof(struct cmd_memory_data, base.interval)), \
+	F("interval", OPT_TYPE_DURATION, offsetof(struct cmd_memory_data, base.interval)), \
+	F("max_interval", OPT_TYPE_DURATION, offsetof(struct cmd_memory_data, base.max_interval)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_memory_data, base.signal)), \
 	F("threshold_critical", OPT_TYPE_BYTE_THRESHOLD, offsetof(struct cmd_memory_data, threshold_critical)), \
 	F("threshold_degraded", OPT_TYPE_BYTE_THRESHOLD, offsetof(struct cmd_memory_data, threshold_degraded)), \
 	F("use_decimal", OPT_TYPE_LONG, offsetof(struct cmd_memory_data, use_decimal)), \
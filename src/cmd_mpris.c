@@ -19,6 +19,7 @@
 #include "fdpoll.h"
 #include "vprint.h"
 #include "dbus_monitor.h"
+#include "coroutine.h"
 
 #include <stdio.h>
 
@@ -30,6 +31,7 @@ struct cmd_mpris_data {
 	char *format_stopped;
 
 	sd_bus *bus;
+	struct coroutine co; ///< reads the initial state of the player
 
 	struct dbus_mpris_data {
 		const struct dbus_fields_t *fields;
@@ -44,7 +46,7 @@ struct cmd_mpris_data {
 	char cached_output[256];
 };
 
-static void cmd_mpris_recache(struct cmd_data_base *_data);
+static bool cmd_mpris_recache(struct cmd_data_base *_data);
 
 #define DBUS_MPRIS_FIELDS(F) \
 	F("Metadata", FIELD_ARR_DICT_EXPAND, 0), \
@@ -57,9 +59,30 @@ static void cmd_mpris_recache(struct cmd_data_base *_data);
 
 DBUS_MONITOR_GEN_FIELDS(cmd_mpris_dbus, DBUS_MPRIS_FIELDS, cmd_mpris_recache, struct cmd_mpris_data, data)
 
+static int cmd_mpris_read_state(struct coroutine *co) {
+	struct cmd_mpris_data *data = co->data;
+
+	CO_BEGIN(co);
+	CO_AWAIT_DBUS(co, -1, sd_bus_call_method_async(data->bus, &co->slot,
+			data->mpris_service, "/org/mpris/MediaPlayer2",
+			"org.freedesktop.DBus.Properties", "GetAll",
+			coroutine_dbus_reply, co, "s", "org.mpris.MediaPlayer2.Player"));
+	if (unlikely(!co->reply))
+		fprintf(stderr, "mpris: reading state of %s failed to be sent\n", data->mpris_service);
+	else if (sd_bus_message_is_method_error(co->reply, NULL)) // no player yet, the watcher catches it once started
+		;
+	else {
+		dbus_parse_arr_fields(co->reply, &data->data);
+		data->base.dirty |= cmd_mpris_recache(&data->base);
+	}
+	co->reply = sd_bus_message_unref(co->reply);
+	CO_END(co);
+}
+
 static bool cmd_mpris_init(struct cmd_data_base *_data) {
 	struct cmd_mpris_data *data = (struct cmd_mpris_data *)_data;
 
+	coroutine_init(&data->co, cmd_mpris_read_state, data);
 	if (!data->mpris_service)
 		return false;
 	if (!data->format_stopped)
@@ -78,16 +101,9 @@ static bool cmd_mpris_init(struct cmd_data_base *_data) {
 	data->data.fields = &cmd_mpris_dbus;
 	dbus_add_watcher(data->mpris_service, "/org/mpris/MediaPlayer2", &data->data);
 
-	sd_bus_get_property_string(data->bus, data->mpris_service, "/org/mpris/MediaPlayer2",
-							   "org.mpris.MediaPlayer2.Player", "PlaybackStatus", NULL, &data->data.playback_status);
-	sd_bus_get_property_trivial(data->bus, data->mpris_service, "/org/mpris/MediaPlayer2",
-								"org.mpris.MediaPlayer2.Player", "Position",
-								NULL, SD_BUS_TYPE_INT64, &data->data.position);
-	sd_bus_message *reply = NULL;
-	if (0 <= sd_bus_get_property(data->bus, data->mpris_service, "/org/mpris/MediaPlayer2",
-								 "org.mpris.MediaPlayer2.Player", "Metadata", NULL, &reply, "a{sv}"))
-		dbus_parse_arr_fields(reply, &data->data);
-	sd_bus_message_unref(reply);
+	// the player may be slow to answer, so its state is read without waiting
+	fdpoll_add(sd_bus_get_fd(data->bus), coroutine_dbus_handler, data->bus);
+	coroutine_start(&data->co);
 
 	data->base.cached_fulltext = data->cached_output;
 	data->base.interval = -1;
@@ -106,28 +122,36 @@ static void cmd_mpris_destroy(struct cmd_data_base *_data) {
 	free(data->data.album);
 	free(data->data.playback_status);
 
-	sd_bus_unref(data->bus);
+	coroutine_destroy(&data->co);
+	sd_bus_slot_unref(data->co.slot);
+	sd_bus_message_unref(data->co.reply);
+	if (data->bus) {
+		fdpoll_remove(sd_bus_get_fd(data->bus));
+		sd_bus_unref(data->bus);
+	}
 }
 
 // generated using command ./scripts/gen-format.py AalpTt
 VPRINT_OPTS(cmd_mpris_var_options, {0x00000000, 0x00000000, 0x00100002, 0x00111002});
 
-static void cmd_mpris_recache(struct cmd_data_base *_data) {
+static bool cmd_mpris_recache(struct cmd_data_base *_data) {
 	struct cmd_mpris_data *data = (struct cmd_mpris_data *)_data;
 
+	bool changed = false;
 	const char *output_format = data->format_stopped;
 	if (!data->data.playback_status);
 	else if (0 == memcmp(data->data.playback_status, "Playing", 8)) {
 		output_format = data->format_playing;
-		CMD_COLOR_SET(data, g_general_settings.color_good);
+		changed = CMD_COLOR_SET(data, g_general_settings.color_good);
 	} else if (0 == memcmp(data->data.playback_status, "Paused", 7)) {
 		output_format = data->format_paused;
-		CMD_COLOR_SET(data, g_general_settings.color_degraded);
+		changed = CMD_COLOR_SET(data, g_general_settings.color_degraded);
 	} else
-		CMD_COLOR_CLEAN(data);
+		changed = CMD_COLOR_CLEAN(data);
 
 	unsigned res;
-	struct vprint ctx = {cmd_mpris_var_options, output_format, data->cached_output, data->cached_output + sizeof(data->cached_output)};
+	char buffer[sizeof(data->cached_output)];
+	struct vprint ctx = VPRINT_INIT(cmd_mpris_var_options, output_format, buffer);
 	while ((res = vprint_walk(&ctx)) != 0) {
 		switch (res) {
 			case 'A':
@@ -159,6 +183,8 @@ static void cmd_mpris_recache(struct cmd_data_base *_data) {
 				break;
 		}
 	}
+	changed |= CMD_TEXT_SET(data, buffer, (size_t)(ctx.buffer_start - buffer));
+	return changed;
 }
 
 static void cmd_mpris_cevent(struct cmd_data_base *_data, unsigned event, unsigned modifiers) {
@@ -190,7 +216,8 @@ static void cmd_mpris_cevent(struct cmd_data_base *_data, unsigned event, unsign
 	F("format_paused", OPT_TYPE_STR, offsetof(struct cmd_mpris_data, format_paused)), \
 	F("format_playing", OPT_TYPE_STR, offsetof(struct cmd_mpris_data, format_playing)), \
 	F("format_stopped", OPT_TYPE_STR, offsetof(struct cmd_mpris_data, format_stopped)), \
-	F("mpris_service", OPT_TYPE_STR, offsetof(struct cmd_mpris_data, mpris_service))
+	F("mpris_service", OPT_TYPE_STR, offsetof(struct cmd_mpris_data, mpris_service)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_mpris_data, base.signal))
 
 CMD_OPTS_GEN_STRUCTS(cmd_mpris, MPRIS_OPTIONS)
 
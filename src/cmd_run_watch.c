@@ -51,10 +51,10 @@ static void cmd_run_watch_destroy(struct cmd_data_base *_data) {
 	free(data->text_up);
 }
 
-static void cmd_run_watch_recache(struct cmd_data_base *_data) {
+static bool cmd_run_watch_recache(struct cmd_data_base *_data) {
 	struct cmd_run_watch_data *data = (struct cmd_run_watch_data *)_data;
 
-	data->base.cached_fulltext = data->text_down;
+	char *text = data->text_down;
 	int fd = open(data->path, O_RDONLY);
 	if (likely(fd >= 0)) {
 		char buf[64];
@@ -63,15 +63,19 @@ static void cmd_run_watch_recache(struct cmd_data_base *_data) {
 			buf[len] = '\0';
 			pid_t pid = (pid_t)atol(buf);
 			if (kill(pid, 0) == 0 || errno == EPERM)
-				data->base.cached_fulltext = data->text_up;
+				text = data->text_up;
 		}
 		close(fd);
 	}
+	return CMD_TEXT_PTR_SET(data, text);
 }
 
 #define RUN_WATCH_OPTIONS(F) \
-	F("interval", OPT_TYPE_LONG, offsetof(struct cmd_run_watch_data, base.interval)), \
+	F("cpu_budget", OPT_TYPE_DURATION, offsetof(struct cmd_run_watch_data, base.cpu_budget)), \
+	F("interval", OPT_TYPE_DURATION, offsetof(struct cmd_run_watch_data, base.interval)), \
+	F("max_interval", OPT_TYPE_DURATION, offsetof(struct cmd_run_watch_data, base.max_interval)), \
 	F("path", OPT_TYPE_STR, offsetof(struct cmd_run_watch_data, path)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_run_watch_data, base.signal)), \
 	F("text_down", OPT_TYPE_STR, offsetof(struct cmd_run_watch_data, text_down)), \
 	F("text_up", OPT_TYPE_STR, offsetof(struct cmd_run_watch_data, text_up)), \
 
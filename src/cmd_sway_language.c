@@ -17,6 +17,7 @@
 
 #include "main.h"
 #include "fdpoll.h"
+#include "coroutine.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,14 +30,6 @@
 
 #include <yajl/yajl_parse.h>
 
-struct cmd_sway_language_data {
-	struct cmd_data_base base;
-
-	char *keyboard_name;
-	int socketfd;
-	char cached_output[256];
-};
-
 struct msg_header_t {
 	char magic[6];
 	uint32_t size;
@@ -55,6 +48,7 @@ enum CURRENT_KEY {
 	CURRENT_KEY_XKB_LAYOUT = 2, // "xkb_active_layout_name"
 };
 
+struct cmd_sway_language_data;
 struct cmd_sway_language_yajl_ctx {
 	struct cmd_sway_language_data *data;
 	const unsigned char *keyboard_layout;
@@ -64,6 +58,21 @@ struct cmd_sway_language_yajl_ctx {
 	bool matching_identifier;
 };
 
+struct cmd_sway_language_data {
+	struct cmd_data_base base;
+
+	char *keyboard_name;
+	int socketfd;
+	char cached_output[256];
+
+	struct coroutine co; ///< reads the replies and events from the socket
+	struct msg_header_t header;
+	uint32_t received; ///< bytes received of the current header or payload
+	yajl_handle yajl;
+	struct cmd_sway_language_yajl_ctx yajl_ctx;
+	uint8_t buffer[2048];
+};
+
 static int cmd_sway_language_yajl_string(void *_ctx, const unsigned char *str, size_t len) {
 	struct cmd_sway_language_yajl_ctx *ctx = _ctx;
 	if (len != 0) {
@@ -108,8 +117,7 @@ static int cmd_sway_language_yajl_end_map(void *_ctx) {
 	if ((--ctx->depth) == 0 && ctx->keyboard_layout && ctx->matching_identifier) {
 		if (ctx->keyboard_layout_len > sizeof(ctx->data->cached_output) - 1)
 			ctx->keyboard_layout_len = sizeof(ctx->data->cached_output) - 1;
-		memcpy(ctx->data->cached_output, ctx->keyboard_layout, ctx->keyboard_layout_len);
-		ctx->data->cached_output[ctx->keyboard_layout_len] = '\0';
+		ctx->data->base.dirty |= CMD_TEXT_SET(ctx->data, (const char *)ctx->keyboard_layout, ctx->keyboard_layout_len);
 		return false;
 	}
 	return true;
@@ -121,31 +129,47 @@ static const yajl_callbacks cevent_callbacks = {
 	.yajl_end_map = cmd_sway_language_yajl_end_map,
 };
 
-static bool handle_sway_language_events(void *arg) {
-	struct cmd_sway_language_data *data = (struct cmd_sway_language_data *)arg;
+/**
+ * @brief cmd_sway_language_reader read the messages from sway, without blocking on partial ones
+ */
+static int cmd_sway_language_reader(struct coroutine *co) {
+	struct cmd_sway_language_data *data = co->data;
+	ssize_t received;
 
-	struct msg_header_t recv_buf;
-	if (unlikely(sizeof(recv_buf) != read(data->socketfd, (&recv_buf), sizeof(recv_buf))))
-		return false;
-	ssize_t remaining = recv_buf.size;
-	uint8_t buffer[2048];
-	struct cmd_sway_language_yajl_ctx ctx = {
-		.data = data
-	};
-	yajl_handle yajl_parse_handle = yajl_alloc(&cevent_callbacks, NULL, &ctx);
-	do {
-		ssize_t received = sizeof(buffer);
-		if (received > remaining)
-			received = remaining;
-		received = read(data->socketfd, buffer, received);
-		if (unlikely(received <= 0))
-			goto _free_yajl;
-		remaining -= received;
-		yajl_parse(yajl_parse_handle, buffer, (size_t)received);
-	} while (remaining > 0);
-_free_yajl:
-	yajl_free(yajl_parse_handle);
-	return false;
+	CO_BEGIN(co);
+	while (true) {
+		for (data->received = 0; data->received < sizeof(data->header); data->received += (uint32_t)received) {
+			CO_AWAIT_FD(co, data->socketfd, POLLIN, -1);
+			received = read(data->socketfd, (char *)&data->header + data->received, sizeof(data->header) - data->received);
+			if (unlikely(received <= 0)) {
+				if (received == 0 || (errno != EAGAIN && errno != EINTR))
+					CO_EXIT(co);
+				received = 0;
+			}
+		}
+
+		data->yajl_ctx = (struct cmd_sway_language_yajl_ctx){ .data = data };
+		data->yajl = yajl_alloc(&cevent_callbacks, NULL, &data->yajl_ctx);
+		for (data->received = 0; data->received < data->header.size; data->received += (uint32_t)received) {
+			CO_AWAIT_FD(co, data->socketfd, POLLIN, -1);
+			received = data->header.size - data->received;
+			if (received > (ssize_t)sizeof(data->buffer))
+				received = sizeof(data->buffer);
+			received = read(data->socketfd, data->buffer, (size_t)received);
+			if (unlikely(received <= 0)) {
+				if (received == 0 || (errno != EAGAIN && errno != EINTR)) {
+					yajl_free(data->yajl);
+					data->yajl = NULL;
+					CO_EXIT(co);
+				}
+				received = 0;
+			} else
+				yajl_parse(data->yajl, data->buffer, (size_t)received);
+		}
+		yajl_free(data->yajl);
+		data->yajl = NULL;
+	}
+	CO_END(co);
 }
 
 static bool cmd_sway_language_init(struct cmd_data_base *_data) {
@@ -160,6 +184,17 @@ static bool cmd_sway_language_init(struct cmd_data_base *_data) {
 		fputs("socket(sway-language) failed\n", stderr);
 		return false;
 	}
+	coroutine_init(&data->co, cmd_sway_language_reader, data);
+
+	data->base.cached_fulltext = data->cached_output;
+	data->base.interval = -1;
+	return true;
+}
+
+static bool cmd_sway_language_init_deferred(struct cmd_data_base *_data) {
+	struct cmd_sway_language_data *data = (struct cmd_sway_language_data *)_data;
+
+	const char *sock = getenv("SWAYSOCK");
 	struct sockaddr_un addr;
 	addr.sun_family = AF_UNIX;
 	strncpy(addr.sun_path, sock, sizeof(addr.sun_path) - 1);
@@ -184,19 +219,19 @@ static bool cmd_sway_language_init(struct cmd_data_base *_data) {
 		return false;
 	}
 
-	fdpoll_add(data->socketfd, handle_sway_language_events, data);
-
-	data->base.cached_fulltext = data->cached_output;
-	data->base.interval = -1;
+	coroutine_start(&data->co);
 	return true;
 }
 
 static void cmd_sway_language_destroy(struct cmd_data_base *_data) {
 	struct cmd_sway_language_data *data = (struct cmd_sway_language_data *)_data;
+	coroutine_destroy(&data->co);
+	if (data->yajl)
+		yajl_free(data->yajl);
 	close(data->socketfd);
 }
 
-static void cmd_sway_language_recache(struct cmd_data_base *_data) {
+static bool cmd_sway_language_recache(struct cmd_data_base *_data) {
 	struct cmd_sway_language_data *data = (struct cmd_sway_language_data *)_data;
 
 	static const struct msg_header_t sway_ipc_get_inputs = {
@@ -205,13 +240,15 @@ static void cmd_sway_language_recache(struct cmd_data_base *_data) {
 		.type = IPC_GET_INPUTS
 	};
 	if (unlikely(0 > write(data->socketfd, &sway_ipc_get_inputs, sizeof(sway_ipc_get_inputs)))) {
-		return;
+		return false;
 	}
+	return false; // reply is handled in cmd_sway_language_reader
 }
 
 #define SWAY_LANG_OPTIONS(F) \
-	F("interval", OPT_TYPE_LONG, offsetof(struct cmd_sway_language_data, base.interval)), \
-	F("keyboard-name", OPT_TYPE_STR, offsetof(struct cmd_sway_language_data, keyboard_name))
+	F("interval", OPT_TYPE_DURATION, offsetof(struct cmd_sway_language_data, base.interval)), \
+	F("keyboard-name", OPT_TYPE_STR, offsetof(struct cmd_sway_language_data, keyboard_name)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_sway_language_data, base.signal))
 
 CMD_OPTS_GEN_STRUCTS(cmd_sway_language, SWAY_LANG_OPTIONS)
 
@@ -222,6 +259,7 @@ DECLARE_CMD(cmd_sway_language) = {
 	.opts = CMD_OPTS_GEN_DATA(cmd_sway_language),
 
 	.func_init = cmd_sway_language_init,
+	.func_init_deferred = cmd_sway_language_init_deferred, // connecting to sway might be slow
 	.func_destroy = cmd_sway_language_destroy,
 	.func_recache = cmd_sway_language_recache
 };
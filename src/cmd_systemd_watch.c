@@ -16,6 +16,9 @@
 */
 
 #include "main.h"
+#include "fdpoll.h"
+#include "coroutine.h"
+#include "dbus_monitor.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,16 +29,84 @@ struct cmd_systemd_watch_data {
 	struct cmd_data_base base;
 	sd_bus *bus;
 	char *unit_path;
+	struct coroutine co;
 
 	long use_user_bus;
 	char *service_name;
 };
 
+/**
+ * @brief cmd_systemd_watch_check_reply check the reply of an awaited call, and show the block as stale if failed
+ */
+static bool cmd_systemd_watch_check_reply(struct cmd_systemd_watch_data *data, const char *method) {
+	sd_bus_message *m = data->co.reply;
+	if (unlikely(!m))
+		fprintf(stderr, "systemd_watch: %s for %s %s\n", method, data->service_name,
+				data->co.timed_out ? "timed out" : "failed to be sent");
+	else if (unlikely(sd_bus_message_is_method_error(m, NULL)))
+		fprintf(stderr, "systemd_watch: %s for %s failed: %s\n", method, data->service_name,
+				sd_bus_message_get_error(m)->message);
+	else
+		return true;
+	data->base.dirty |= CMD_COLOR_SET(data, g_general_settings.color_bad);
+	return false;
+}
+
+static int cmd_systemd_watch_body(struct coroutine *co) {
+	struct cmd_systemd_watch_data *data = co->data;
+	const long timeout = data->base.timeout > 0 ? data->base.timeout : data->base.interval;
+	int r;
+	const char *str;
+
+	CO_BEGIN(co);
+	if (!data->unit_path) {
+		CO_AWAIT_DBUS(co, timeout, sd_bus_call_method_async(data->bus, &co->slot,
+				"org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+				"org.freedesktop.systemd1.Manager", "LoadUnit",
+				coroutine_dbus_reply, co, "s", data->service_name));
+		if (!cmd_systemd_watch_check_reply(data, "LoadUnit"))
+			goto _unref;
+		if ((r = sd_bus_message_read(co->reply, "o", &str)) < 0)
+			fprintf(stderr, "systemd_watch: Failed to parse response message: %s\n", strerror(-r));
+		else
+			data->unit_path = strdup(str);
+		co->reply = sd_bus_message_unref(co->reply);
+		if (!data->unit_path)
+			CO_EXIT(co);
+	}
+
+	CO_AWAIT_DBUS(co, timeout, sd_bus_call_method_async(data->bus, &co->slot,
+			"org.freedesktop.systemd1", data->unit_path,
+			"org.freedesktop.DBus.Properties", "Get",
+			coroutine_dbus_reply, co, "ss", "org.freedesktop.systemd1.Unit", "ActiveState"));
+	if (!cmd_systemd_watch_check_reply(data, "ActiveState"))
+		goto _unref;
+	if (likely(0 <= sd_bus_message_read(co->reply, "v", "s", &str))) {
+		char *prev = data->base.cached_fulltext;
+		const bool changed = !prev || 0 != strcmp(prev, str);
+		if (changed) {
+			data->base.cached_fulltext = strdup(str);
+			data->base.cached_fulltext_len = (unsigned)strlen(str);
+			free(prev);
+		}
+		data->base.dirty |= CMD_COLOR_CLEAN(data) | changed;
+	}
+_unref:
+	co->reply = sd_bus_message_unref(co->reply);
+	CO_END(co);
+}
+
 static bool cmd_systemd_watch_init(struct cmd_data_base *_data) {
 	struct cmd_systemd_watch_data *data = (struct cmd_systemd_watch_data *)_data;
 
 	if (!data->service_name)
 		return false;
+	coroutine_init(&data->co, cmd_systemd_watch_body, data);
+	return true;
+}
+
+static bool cmd_systemd_watch_init_deferred(struct cmd_data_base *_data) {
+	struct cmd_systemd_watch_data *data = (struct cmd_systemd_watch_data *)_data;
 
 	int r = data->use_user_bus ? sd_bus_open_user(&data->bus) : sd_bus_open_system(&data->bus);
 	if (r < 0) {
@@ -43,46 +114,37 @@ static bool cmd_systemd_watch_init(struct cmd_data_base *_data) {
 				data->use_user_bus ? "user" : "system", strerror(-r));
 		return false;
 	}
-	sd_bus_error error = SD_BUS_ERROR_NULL;
-	sd_bus_message *m = NULL;
-
-	r = sd_bus_call_method(data->bus,
-						   "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
-						   "org.freedesktop.systemd1.Manager", "LoadUnit",
-						   &error, &m, "s", data->service_name);
-	if (r < 0)
-		fprintf(stderr, "systemd_watch: Failed to issue method call: %s\n", error.message);
-	else if ((r = sd_bus_message_read(m, "o", &data->unit_path)) < 0)
-		fprintf(stderr, "systemd_watch: Failed to parse response message: %s\n", strerror(-r));
-	else // successful
-		data->unit_path = strdup(data->unit_path);
-
-	sd_bus_error_free(&error);
-	sd_bus_message_unref(m);
-	return r >= 0;
+	fdpoll_add(sd_bus_get_fd(data->bus), coroutine_dbus_handler, data->bus);
+	return true;
 }
 
 static void cmd_systemd_watch_destroy(struct cmd_data_base *_data) {
 	struct cmd_systemd_watch_data *data = (struct cmd_systemd_watch_data *)_data;
-	sd_bus_unref(data->bus);
+	coroutine_destroy(&data->co);
+	sd_bus_slot_unref(data->co.slot);
+	sd_bus_message_unref(data->co.reply);
+	if (data->bus) {
+		fdpoll_remove(sd_bus_get_fd(data->bus));
+		sd_bus_unref(data->bus);
+	}
 	free(data->service_name);
 	free(data->unit_path);
 	free(data->base.cached_fulltext);
 }
 
-static void cmd_systemd_watch_recache(struct cmd_data_base *_data) {
+static bool cmd_systemd_watch_recache(struct cmd_data_base *_data) {
 	struct cmd_systemd_watch_data *data = (struct cmd_systemd_watch_data *)_data;
-
-	free(data->base.cached_fulltext);
-	data->base.cached_fulltext = NULL;
-	sd_bus_get_property_string(data->bus, "org.freedesktop.systemd1", data->unit_path,
-							   "org.freedesktop.systemd1.Unit", "ActiveState",
-							   NULL, &data->base.cached_fulltext);
+	coroutine_start(&data->co); // a still pending call is left to finish
+	return false; // the reply marks the block dirty
 }
 
 #define SYSTEMD_WATCH_OPTIONS(F) \
-	F("interval", OPT_TYPE_LONG, offsetof(struct cmd_systemd_watch_data, base.interval)), \
+	F("cpu_budget", OPT_TYPE_DURATION, offsetof(struct cmd_systemd_watch_data, base.cpu_budget)), \
+	F("interval", OPT_TYPE_DURATION, offsetof(struct cmd_systemd_watch_data, base.interval)), \
+	F("max_interval", OPT_TYPE_DURATION, offsetof(struct cmd_systemd_watch_data, base.max_interval)), \
 	F("service", OPT_TYPE_STR, offsetof(struct cmd_systemd_watch_data, service_name)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_systemd_watch_data, base.signal)), \
+	F("timeout", OPT_TYPE_DURATION, offsetof(struct cmd_systemd_watch_data, base.timeout)), \
 	F("use_user_bus", OPT_TYPE_LONG, offsetof(struct cmd_systemd_watch_data, use_user_bus))
 
 CMD_OPTS_GEN_STRUCTS(cmd_systemd_watch, SYSTEMD_WATCH_OPTIONS)
@@ -94,6 +156,7 @@ DECLARE_CMD(cmd_systemd_watch) = {
 	.opts = CMD_OPTS_GEN_DATA(cmd_systemd_watch),
 
 	.func_init = cmd_systemd_watch_init,
+	.func_init_deferred = cmd_systemd_watch_init_deferred, // connecting to the bus might be slow
 	.func_destroy = cmd_systemd_watch_destroy,
 	.func_recache = cmd_systemd_watch_recache
 };
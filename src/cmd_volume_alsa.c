@@ -43,11 +43,13 @@ struct cmd_volume_alsa_data {
 	char cached_output[256];
 };
 
-static void cmd_volume_alsa_recache(struct cmd_data_base *_data);
+static bool cmd_volume_alsa_recache(struct cmd_data_base *_data);
 
 static int cmd_volume_alsa_mixer_event(snd_mixer_elem_t *elem, unsigned int mask) {
-	if (mask & SND_CTL_EVENT_MASK_VALUE)
-		cmd_volume_alsa_recache((struct cmd_data_base *)snd_mixer_elem_get_callback_private(elem));
+	if (mask & SND_CTL_EVENT_MASK_VALUE) {
+		struct cmd_data_base *data = (struct cmd_data_base *)snd_mixer_elem_get_callback_private(elem);
+		data->dirty |= cmd_volume_alsa_recache(data);
+	}
 	return 0;
 }
 
@@ -72,8 +74,17 @@ static bool cmd_volume_alsa_init(struct cmd_data_base *_data) {
 		return false;
 	}
 
-	err = snd_mixer_attach(data->mixer, (data->device ? data->device : "default"));
+	data->base.cached_fulltext = data->cached_output;
+	data->base.interval = -1;
+	return true;
+}
+
+static bool cmd_volume_alsa_init_deferred(struct cmd_data_base *_data) {
+	struct cmd_volume_alsa_data *data = (struct cmd_volume_alsa_data *)_data;
+
+	int err = snd_mixer_attach(data->mixer, (data->device ? data->device : "default"));
 	free(data->device);
+	data->device = NULL;
 	if (err < 0) {
 		fprintf(stderr, "ALSA: Cannot attach mixer to device: %s\n", snd_strerror(err));
 		goto _error_mixer;
@@ -99,6 +110,7 @@ static bool cmd_volume_alsa_init(struct cmd_data_base *_data) {
 	snd_mixer_selem_id_set_index(data->sid, (unsigned int)data->mixer_idx);
 	snd_mixer_selem_id_set_name(data->sid, (data->mixer_name ? data->mixer_name : "Master"));
 	free(data->mixer_name);
+	data->mixer_name = NULL;
 	if (!(data->elem = snd_mixer_find_selem(data->mixer, data->sid))) {
 		fprintf(stderr, "ALSA: Cannot find mixer\n");
 		snd_mixer_selem_id_free(data->sid);
@@ -123,9 +135,6 @@ static bool cmd_volume_alsa_init(struct cmd_data_base *_data) {
 		for (unsigned i = 0; i < count; ++i)
 			fdpoll_add(polls[i].fd, handle_volume_alsa_read, data->mixer);
 	}
-
-	data->base.cached_fulltext = data->cached_output;
-	data->base.interval = -1;
 	return true;
 _error_mixer:
 	snd_mixer_close(data->mixer);
@@ -135,8 +144,11 @@ _error_mixer:
 
 static void cmd_volume_alsa_destroy(struct cmd_data_base *_data) {
 	struct cmd_volume_alsa_data *data = (struct cmd_volume_alsa_data *)_data;
-	snd_mixer_close(data->mixer);
+	if (data->mixer)
+		snd_mixer_close(data->mixer);
 	snd_mixer_selem_id_free(data->sid);
+	free(data->device);
+	free(data->mixer_name);
 	free(data->format);
 	free(data->format_muted);
 }
@@ -144,7 +156,7 @@ static void cmd_volume_alsa_destroy(struct cmd_data_base *_data) {
 // generated using command ./scripts/gen-format.py vV
 VPRINT_OPTS(cmd_volume_alsa_var_options, {0x00000000, 0x00000000, 0x00400000, 0x00400000});
 
-static void cmd_volume_alsa_recache(struct cmd_data_base *_data) {
+static bool cmd_volume_alsa_recache(struct cmd_data_base *_data) {
 	struct cmd_volume_alsa_data *data = (struct cmd_volume_alsa_data *)_data;
 
 	long mixer_volume;
@@ -152,22 +164,26 @@ static void cmd_volume_alsa_recache(struct cmd_data_base *_data) {
 
 	const int volume = (int)(((mixer_volume - data->volume_min) * 100 + data->volume_range / 2) / data->volume_range);
 	const char *output_format = data->format;
-	CMD_COLOR_CLEAN(data);
+	const char *color = "";
 	if (data->supportes_mute) {
 		int pbval, res;
 		if ((res = snd_mixer_selem_get_playback_switch(data->elem, 0, &pbval)) < 0)
 			fprintf(stderr, "ALSA: get_playback_switch: %s\n", snd_strerror(res));
 		if (!pbval) {
-			CMD_COLOR_SET(data, g_general_settings.color_degraded);
+			color = g_general_settings.color_degraded;
 			if (data->format_muted)
 				output_format = data->format_muted;
 		}
 	}
+	bool changed = cmd_cache_color(data->base.cached_color, color);
 
-	struct vprint ctx = {cmd_volume_alsa_var_options, output_format, data->cached_output, data->cached_output + sizeof(data->cached_output)};
+	char buffer[sizeof(data->cached_output)];
+	struct vprint ctx = VPRINT_INIT(cmd_volume_alsa_var_options, output_format, buffer);
 	while (vprint_walk(&ctx) != 0) {
 		vprint_itoa(&ctx, volume);
 	}
+	changed |= CMD_TEXT_SET(data, buffer, (size_t)(ctx.buffer_start - buffer));
+	return changed;
 }
 
 static void cmd_volume_alsa_cevent(struct cmd_data_base *_data, unsigned event, unsigned modifiers) {
@@ -183,38 +199,34 @@ static void cmd_volume_alsa_cevent(struct cmd_data_base *_data, unsigned event,
 				else if ((res = snd_mixer_selem_set_playback_switch(data->elem, 0, !pbval)) < 0)
 					fprintf(stderr, "ALSA: set_playback_switch: %s\n", snd_strerror(res));
 				else
-					cmd_volume_alsa_recache(_data);
-			}
-			break;
-		case CEVENT_MOUSE_WHEEL_UP:
-		case CEVENT_MOUSE_WHEEL_DOWN: {
-			long val;
-			snd_mixer_selem_get_playback_volume(data->elem, 0, &val);
-
-			const long change = (data->wheel_step * data->volume_range + (100 / 2)) / 100;
-			if (event == CEVENT_MOUSE_WHEEL_UP) {
-				val += change;
-				const long max = data->volume_min + data->volume_range;
-				if (val > max)
-					val = max;
-			} else {
-				val -= change;
-				if (val < data->volume_min)
-					val = data->volume_min;
+					_data->dirty |= cmd_volume_alsa_recache(_data);
 			}
-			snd_mixer_selem_set_playback_volume(data->elem, 0, val);
-			cmd_volume_alsa_recache(_data);
 			break;
-		}
 	}
 }
 
+static void cmd_volume_alsa_wheel(struct cmd_data_base *_data, int steps) {
+	struct cmd_volume_alsa_data *data = (struct cmd_volume_alsa_data *)_data;
+	long val;
+	snd_mixer_selem_get_playback_volume(data->elem, 0, &val);
+
+	val += steps * ((data->wheel_step * data->volume_range + (100 / 2)) / 100);
+	const long max = data->volume_min + data->volume_range;
+	if (val > max)
+		val = max;
+	else if (val < data->volume_min)
+		val = data->volume_min;
+	snd_mixer_selem_set_playback_volume(data->elem, 0, val);
+	_data->dirty |= cmd_volume_alsa_recache(_data);
+}
+
 #define VOLUME_ALSA_OPTIONS(F) \
 	F("device", OPT_TYPE_STR, offsetof(struct cmd_volume_alsa_data, device)), \
 	F("format", OPT_TYPE_STR, offsetof(struct cmd_volume_alsa_data, format)), \
 	F("format_muted", OPT_TYPE_STR, offsetof(struct cmd_volume_alsa_data, format_muted)), \
 	F("mixer", OPT_TYPE_STR, offsetof(struct cmd_volume_alsa_data, mixer_name)), \
 	F("mixer_idx", OPT_TYPE_LONG, offsetof(struct cmd_volume_alsa_data, mixer_idx)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_volume_alsa_data, base.signal)), \
 	F("wheel_step", OPT_TYPE_LONG, offsetof(struct cmd_volume_alsa_data, wheel_step))
 
 CMD_OPTS_GEN_STRUCTS(cmd_volume_alsa, VOLUME_ALSA_OPTIONS)
@@ -226,7 +238,9 @@ DECLARE_CMD(cmd_volume_alsa) = {
 	.opts = CMD_OPTS_GEN_DATA(cmd_volume_alsa),
 
 	.func_init = cmd_volume_alsa_init,
+	.func_init_deferred = cmd_volume_alsa_init_deferred, // loading the mixer might be slow
 	.func_destroy = cmd_volume_alsa_destroy,
 	.func_recache = cmd_volume_alsa_recache,
-	.func_cevent = cmd_volume_alsa_cevent
+	.func_cevent = cmd_volume_alsa_cevent,
+	.func_wheel = cmd_volume_alsa_wheel
 };
@@ -39,7 +39,7 @@ struct cmd_x11_language_data {
 	char *lan2_upper;
 };
 
-static void cmd_x11_language_recache(struct cmd_data_base *_data);
+static bool cmd_x11_language_recache(struct cmd_data_base *_data);
 
 bool handle_x11_lan_events(void *arg) {
 	struct cmd_x11_language_data *data = (struct cmd_x11_language_data *)arg;
@@ -49,7 +49,7 @@ bool handle_x11_lan_events(void *arg) {
 	if (likely(e.type == data->xkbEventType)) {
 		XkbEvent *xkbEvent = (XkbEvent *)&e;
 		if (xkbEvent->any.xkb_type == XkbStateNotify || xkbEvent->any.xkb_type == XkbIndicatorStateNotify)
-			cmd_x11_language_recache(arg);
+			data->base.dirty |= cmd_x11_language_recache(arg);
 	}
 	return false;
 }
@@ -57,12 +57,6 @@ bool handle_x11_lan_events(void *arg) {
 static bool cmd_x11_language_init(struct cmd_data_base *_data) {
 	struct cmd_x11_language_data *data = (struct cmd_x11_language_data *)_data;
 
-	data->dpy = XOpenDisplay(data->display);
-	free(data->display);
-	data->display = NULL;
-	if (!data->dpy)
-		return false;
-
 	if (!data->lan1_def)
 		return false;
 	data->lan1_upper = strdup(data->lan1_def);
@@ -75,6 +69,19 @@ static bool cmd_x11_language_init(struct cmd_data_base *_data) {
 	for (char *ptr = data->lan2_upper; *ptr; ++ptr)
 		*ptr &= ~0x20; // make upper case
 
+	data->base.interval = -1;
+	return true;
+}
+
+static bool cmd_x11_language_init_deferred(struct cmd_data_base *_data) {
+	struct cmd_x11_language_data *data = (struct cmd_x11_language_data *)_data;
+
+	data->dpy = XOpenDisplay(data->display);
+	free(data->display);
+	data->display = NULL;
+	if (!data->dpy)
+		return false;
+
 	XKeysymToKeycode(data->dpy, XK_F1);
 	XkbQueryExtension(data->dpy, 0, &data->xkbEventType, 0, 0, 0);
 	XkbSelectEvents(data->dpy, XkbUseCoreKbd, XkbAllEventsMask, XkbStateNotifyMask | XkbIndicatorStateNotifyMask);
@@ -82,8 +89,6 @@ static bool cmd_x11_language_init(struct cmd_data_base *_data) {
 	XSync(data->dpy, false);
 
 	fdpoll_add(ConnectionNumber(data->dpy), handle_x11_lan_events, data);
-
-	data->base.interval = -1;
 	return true;
 }
 
@@ -94,11 +99,13 @@ static void cmd_x11_language_destroy(struct cmd_data_base *_data) {
 	free(data->lan1_upper);
 	free(data->lan2_def);
 	free(data->lan2_upper);
+	free(data->display);
 
-	XCloseDisplay(data->dpy);
+	if (data->dpy)
+		XCloseDisplay(data->dpy);
 }
 
-static void cmd_x11_language_recache(struct cmd_data_base *_data) {
+static bool cmd_x11_language_recache(struct cmd_data_base *_data) {
 	struct cmd_x11_language_data *data = (struct cmd_x11_language_data *)_data;
 
 	XKeyboardState values;
@@ -108,12 +115,12 @@ static void cmd_x11_language_recache(struct cmd_data_base *_data) {
 #define BIT_MOVE(val,src,dst) (((val) & (1U << (src))) >> ((src) - (dst)))
 
 	unsigned cached_index = BIT_MOVE(lan, 12, 1) | BIT_MOVE(lan, 0, 0);
-	data->base.cached_fulltext = *(&data->lan1_def + cached_index);
+	bool changed = CMD_TEXT_PTR_SET(data, *(&data->lan1_def + cached_index));
 
 	if ((lan & 0x2U) == 0)
-		CMD_COLOR_SET(data, g_general_settings.color_degraded);
+		changed |= CMD_COLOR_SET(data, g_general_settings.color_degraded);
 	else
-		CMD_COLOR_CLEAN(data);
+		changed |= CMD_COLOR_CLEAN(data);
 
 #define BAT_POS_CHECK(pos, field) \
 	_Static_assert(offsetof(struct cmd_x11_language_data, field) - offsetof(struct cmd_x11_language_data, lan1_def) == (pos) * sizeof(char *), \
@@ -123,6 +130,7 @@ static void cmd_x11_language_recache(struct cmd_data_base *_data) {
 			BAT_POS_CHECK(2, lan2_def);
 			BAT_POS_CHECK(3, lan2_upper);
 #undef BAT_POS_CHECK
+	return changed;
 }
 
 static void cmd_x11_language_cevent(struct cmd_data_base *_data, unsigned event, unsigned modifiers) {
@@ -145,14 +153,15 @@ static void cmd_x11_language_cevent(struct cmd_data_base *_data, unsigned event,
 	XGetKeyboardControl(data->dpy, &values);
 	unsigned value_mask = ((values.led_mask & check_mask) == 0) ? toogle_mask : 0;
 	XkbLockModifiers(data->dpy, XkbUseCoreKbd, toogle_mask, value_mask);
-	cmd_x11_language_recache(_data);
+	_data->dirty |= cmd_x11_language_recache(_data);
 }
 
 #define X11_LANG_OPTIONS(F) \
 	F("display", OPT_TYPE_STR, offsetof(struct cmd_x11_language_data, display)), \
-	F("interval", OPT_TYPE_LONG, offsetof(struct cmd_x11_language_data, base.interval)), \
+	F("interval", OPT_TYPE_DURATION, offsetof(struct cmd_x11_language_data, base.interval)), \
 	F("language1", OPT_TYPE_STR, offsetof(struct cmd_x11_language_data, lan1_def)), \
 	F("language2", OPT_TYPE_STR, offsetof(struct cmd_x11_language_data, lan2_def)), \
+	F("signal", OPT_TYPE_LONG, offsetof(struct cmd_x11_language_data, base.signal)), \
 
 CMD_OPTS_GEN_STRUCTS(cmd_x11_language, X11_LANG_OPTIONS)
 
@@ -163,6 +172,7 @@ DECLARE_CMD(cmd_x11_language) = {
 	.opts = CMD_OPTS_GEN_DATA(cmd_x11_language),
 
 	.func_init = cmd_x11_language_init,
+	.func_init_deferred = cmd_x11_language_init_deferred, // XOpenDisplay might be slow
 	.func_destroy = cmd_x11_language_destroy,
 	.func_recache = cmd_x11_language_recache,
 	.func_cevent = cmd_x11_language_cevent
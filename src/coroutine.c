@@ -0,0 +1,198 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "coroutine.h"
+#include "main.h"
+#include "fdpoll.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <errno.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+static struct coroutine *g_woken = NULL; ///< coroutines to resume on coroutine_run_woken
+
+static void coroutine_resume(struct coroutine *co, bool timed_out) {
+	if (co->timer_armed) {
+		static const struct itimerspec disarm = {{0, 0}, {0, 0}};
+		timerfd_settime(co->timer_fd, 0, &disarm, NULL);
+		co->timer_armed = false;
+	}
+	co->waiting_fd = false;
+	co->timed_out = timed_out;
+	if (co->func(co) == CO_DONE) {
+		co->line = 0;
+		if (co->fd >= 0) {
+			fdpoll_remove(co->fd);
+			co->fd = -1;
+		}
+	} else if (!co->waiting_fd && co->fd_events != 0) { // awaits something else, don't spin on a ready fd
+		fdpoll_modify(co->fd, 0);
+		co->fd_events = 0;
+	}
+}
+
+static bool coroutine_handle_fd(void *arg) {
+	struct coroutine *co = arg;
+	if (likely(co->waiting_fd))
+		coroutine_resume(co, false);
+	return false;
+}
+
+static bool coroutine_handle_timer(void *arg) {
+	struct coroutine *co = arg;
+	uint64_t expirations;
+	if (unlikely(sizeof(expirations) != read(co->timer_fd, &expirations, sizeof(expirations))))
+		return false;
+	if (likely(co->timer_armed)) {
+		co->timer_armed = false;
+		coroutine_resume(co, true);
+	}
+	return false;
+}
+
+void coroutine_init(struct coroutine *co, int (*func)(struct coroutine *), void *data) {
+	memset(co, 0, sizeof(*co));
+	co->func = func;
+	co->data = data;
+	co->fd = -1;
+	co->timer_fd = -1;
+}
+
+bool coroutine_start(struct coroutine *co) {
+	if (co->line != 0)
+		return false;
+	coroutine_resume(co, false);
+	return true;
+}
+
+void coroutine_destroy(struct coroutine *co) {
+	if (co->fd >= 0)
+		fdpoll_remove(co->fd);
+	if (co->timer_fd >= 0) {
+		fdpoll_remove(co->timer_fd);
+		close(co->timer_fd);
+	}
+	for (struct coroutine **iter = &g_woken; *iter; iter = &(*iter)->next_ready) {
+		if (*iter == co) {
+			*iter = co->next_ready;
+			break;
+		}
+	}
+	co->fd = co->timer_fd = -1;
+	co->line = 0;
+}
+
+void coroutine_wait(struct coroutine *co, int fd, short events, long timeout) {
+	if (fd >= 0) {
+		if (fd != co->fd) {
+			if (co->fd >= 0)
+				fdpoll_remove(co->fd);
+			fdpoll_add_events(fd, events, coroutine_handle_fd, co);
+			co->fd = fd;
+		} else if (events != co->fd_events)
+			fdpoll_modify(fd, events);
+		co->fd_events = events;
+		co->waiting_fd = true;
+	}
+	if (timeout >= 0) {
+		if (co->timer_fd < 0) {
+			if (unlikely(0 > (co->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)))) {
+				fprintf(stderr, "coroutine: timerfd_create failed with %s\n", strerror(errno));
+				return;
+			}
+			fdpoll_add(co->timer_fd, coroutine_handle_timer, co);
+		}
+		if (timeout == 0) // zero disarms a timerfd
+			timeout = 1;
+		const struct itimerspec its = {{0, 0}, {timeout / 1000, (timeout % 1000) * 1000000L}};
+		co->timer_armed = (0 == timerfd_settime(co->timer_fd, 0, &its, NULL));
+	}
+}
+
+void coroutine_wake(struct coroutine *co) {
+	co->next_ready = g_woken;
+	g_woken = co;
+}
+
+void coroutine_run_woken(void) {
+	while (g_woken) {
+		struct coroutine *co = g_woken;
+		g_woken = co->next_ready;
+		co->next_ready = NULL;
+		coroutine_resume(co, false);
+	}
+}
+
+#ifdef TESTS
+
+struct test_coroutine_data {
+	int pipefd[2];
+	char received[4];
+	unsigned received_size;
+	unsigned timeouts;
+};
+
+static int test_coroutine_body(struct coroutine *co) {
+	struct test_coroutine_data *data = co->data;
+	CO_BEGIN(co);
+	while (data->received_size < sizeof(data->received)) {
+		CO_AWAIT_FD(co, data->pipefd[0], POLLIN, 1000);
+		if (co->timed_out)
+			CO_EXIT(co);
+		if (1 == read(data->pipefd[0], data->received + data->received_size, 1))
+			data->received_size++;
+	}
+	CO_SLEEP(co, 10);
+	data->timeouts += co->timed_out;
+	CO_END(co);
+}
+
+int test_coroutine(void) {
+#define TEST_ERR(...) ((void)fprintf(stderr, __VA_ARGS__), false)
+#define ERR_STR(str) "test_coroutine: "str"\n"
+	struct test_coroutine_data data = {.received_size = 0, .timeouts = 0};
+	if (0 != pipe(data.pipefd))
+		return TEST_ERR(ERR_STR("pipe failed"));
+	struct coroutine co;
+	coroutine_init(&co, test_coroutine_body, &data);
+	int res = true;
+	if (!coroutine_start(&co) || coroutine_start(&co))
+		res = TEST_ERR(ERR_STR("coroutine should start once"));
+	if (0 > write(data.pipefd[1], "ab", 2))
+		res = TEST_ERR(ERR_STR("write failed"));
+	for (unsigned i = 0; i < 4 && data.received_size < 2; i++)
+		fdpoll_run(100);
+	if (data.received_size != 2 || co.line == 0)
+		res = TEST_ERR(ERR_STR("expected 2 bytes with the body waiting, got %u"), data.received_size);
+	if (0 > write(data.pipefd[1], "cd", 2))
+		res = TEST_ERR(ERR_STR("write failed"));
+	for (unsigned i = 0; i < 10 && co.line != 0; i++)
+		fdpoll_run(100);
+	if (co.line != 0 || data.timeouts != 1 || 0 != memcmp(data.received, "abcd", 4))
+		res = TEST_ERR(ERR_STR("expected the body to finish after its sleep"));
+	coroutine_destroy(&co);
+	close(data.pipefd[0]);
+	close(data.pipefd[1]);
+	return res;
+#undef ERR_STR
+#undef TEST_ERR
+}
+
+#endif
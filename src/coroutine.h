@@ -0,0 +1,104 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <stdbool.h>
+
+struct sd_bus_slot;
+struct sd_bus_message;
+
+/**
+ * @brief a stackless coroutine (protothread) driven by fdpoll
+ *
+ * The body is a function built between CO_BEGIN and CO_END, which returns
+ * whenever it has to wait, and is resumed by fdpoll at the same place once
+ * the awaited fd is ready, the timeout passed or the D-Bus reply arrived.
+ * As the stack isn't kept, local variables lose their values on each
+ * await, so state which lives across awaits must be kept in @ref data.
+ * Also, awaits can't be used inside a switch statement of the body, and
+ * only one await may be written per line.
+ */
+struct coroutine {
+	int (*func)(struct coroutine *co); ///< the body, returns CO_WAITING or CO_DONE
+	void *data;
+	unsigned line; ///< resume point in the body, 0 when not running
+	int fd; ///< fd registered in fdpoll for the body, -1 if none
+	short fd_events; ///< events currently watched on fd
+	bool waiting_fd; ///< the body waits for fd to be ready
+	bool timer_armed;
+	bool timed_out; ///< the last await ended because of its timeout
+	int timer_fd; ///< created on first await with timeout
+	struct sd_bus_slot *slot; ///< pending D-Bus call of CO_AWAIT_DBUS
+	struct sd_bus_message *reply; ///< reply of CO_AWAIT_DBUS, NULL on timeout or failure
+	struct coroutine *next_ready; ///< in the list of coroutines woken by coroutine_wake
+};
+
+enum coroutine_result {
+	CO_DONE = 0,
+	CO_WAITING = 1,
+};
+
+#define CO_BEGIN(co) switch ((co)->line) { case 0:
+#define CO_END(co) } (co)->line = 0; return CO_DONE
+/// leave the body, the next coroutine_start runs it from the beginning
+#define CO_EXIT(co) do { (co)->line = 0; return CO_DONE; } while (0)
+#define CO_WAIT_(co) do { (co)->line = __LINE__; return CO_WAITING; case __LINE__:; } while (0)
+/// wait until @arg fd has any of @arg events, or @arg timeout milliseconds passed (negative to wait forever)
+#define CO_AWAIT_FD(co, fd, events, timeout) do { coroutine_wait((co), (fd), (events), (timeout)); CO_WAIT_(co); } while (0)
+#define CO_SLEEP(co, ms) CO_AWAIT_FD(co, -1, 0, ms)
+/**
+ * @brief wait for the reply of an async D-Bus @arg call
+ *
+ * @arg call must pass &co->slot as the slot and coroutine_dbus_reply with
+ * @arg co as the callback. After it, co->reply holds the reply, or NULL if
+ * the call failed or timed out (in which case the call is cancelled).
+ */
+#define CO_AWAIT_DBUS(co, timeout, call) do { \
+		(co)->reply = NULL; \
+		if (likely(0 <= (call))) { \
+			coroutine_wait((co), -1, 0, (timeout)); \
+			CO_WAIT_(co); \
+			(co)->slot = sd_bus_slot_unref((co)->slot); \
+		} \
+	} while (0)
+
+void coroutine_init(struct coroutine *co, int (*func)(struct coroutine *), void *data);
+/**
+ * @brief coroutine_start run the body from the beginning, unless it is already running
+ *
+ * @return false if the body is still waiting from a previous start
+ */
+bool coroutine_start(struct coroutine *co);
+void coroutine_destroy(struct coroutine *co);
+/// used by the await macros
+void coroutine_wait(struct coroutine *co, int fd, short events, long timeout);
+/**
+ * @brief coroutine_wake resume @arg co on the next coroutine_run_woken
+ *
+ * Used from callbacks which can't resume the body directly, like D-Bus
+ * reply handlers running inside sd_bus_process.
+ */
+void coroutine_wake(struct coroutine *co);
+void coroutine_run_woken(void);
+
+#ifdef TESTS
+int test_coroutine(void);
+#endif
+
+#endif // COROUTINE_H
@@ -0,0 +1,347 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "daemon.h"
+#include "main.h"
+#include "ini_parser.h"
+#include "fdpoll.h"
+#include "output.h"
+#include "handle_click_event.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DAEMON_SELECTION_MAX 4096
+
+struct daemon_client {
+	struct daemon_client *next;
+	int fd;
+	bool selected; ///< the selection was received, so frames are sent
+
+	char *selection; ///< received selection, until its terminating empty line
+	unsigned selection_len;
+
+	struct run_instance **blocks; ///< selected blocks, in config order
+	size_t blocks_count;
+	struct output_frame frame;
+	struct cevent_parser *cevent;
+};
+
+static struct {
+	struct runs_list *runs;
+	const struct output_sink *sink;
+	struct daemon_client *clients;
+	const char *path;
+	int listen_fd;
+} g_daemon = {NULL, NULL, NULL, NULL, -1};
+
+static bool daemon_write_all(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		const ssize_t res = write(fd, buf, len);
+		if (unlikely(res < 0)) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		buf += res;
+		len -= (size_t)res;
+	}
+	return true;
+}
+
+/**
+ * @brief daemon_select_blocks find the blocks matching the selection
+ *
+ * @param selection lines of "name" or "name instance", empty selects all blocks
+ * @param blocks output array, with space for all blocks
+ * @return number of selected blocks
+ */
+static size_t daemon_select_blocks(struct runs_list *runs, const char *selection, struct run_instance **blocks) {
+	size_t count = 0;
+	FOREACH_RUN(run, runs) {
+		bool match = (selection[0] == '\0');
+		for (const char *line = selection; !match && *line != '\0'; ) {
+			const char *end = strchrnul(line, '\n');
+			const char *space = memchr(line, ' ', (size_t)(end - line));
+			const size_t name_len = (size_t)((space ? space : end) - line);
+			match = (name_len == strlen(run->vtable->name) && 0 == memcmp(line, run->vtable->name, name_len));
+			if (match && space) {
+				const size_t instance_len = (size_t)(end - space - 1);
+				match = (run->instance && instance_len == strlen(run->instance) && 0 == memcmp(space + 1, run->instance, instance_len));
+			}
+			line = (*end != '\0' ? end + 1 : end);
+		}
+		if (match)
+			blocks[count++] = run;
+	}
+	return count;
+}
+
+static void daemon_client_close(struct daemon_client *client) {
+	struct daemon_client **iter = &g_daemon.clients;
+	for (; *iter != client; iter = &(*iter)->next);
+	*iter = client->next;
+
+	fdpoll_remove(client->fd);
+	close(client->fd);
+	output_frame_free(&client->frame);
+	cevent_parser_free(client->cevent);
+	free(client->selection);
+	free(client->blocks);
+	free(client);
+}
+
+static void daemon_client_watch(struct daemon_client *client) {
+	fdpoll_modify(client->fd, POLLIN | (output_frame_busy(&client->frame) ? POLLOUT : 0));
+}
+
+/**
+ * @brief daemon_client_selection collect the selection, and once complete start sending frames
+ *
+ * @return false if the client should be disconnected
+ */
+static bool daemon_client_selection(struct daemon_client *client, const uint8_t *input, size_t len) {
+	if (unlikely(client->selection_len + len > DAEMON_SELECTION_MAX))
+		return false;
+	memcpy(client->selection + client->selection_len, input, len);
+	client->selection_len += (unsigned)len;
+	client->selection[client->selection_len] = '\0';
+
+	char *end = (client->selection[0] == '\n' ? client->selection : strstr(client->selection, "\n\n"));
+	if (end == NULL) // wait for rest of selection
+		return true;
+	*end = '\0';
+	const char *rest = end + (end == client->selection ? 1 : 2);
+	const size_t rest_len = client->selection_len - (size_t)(rest - client->selection);
+
+	client->blocks = malloc(sizeof(struct run_instance *) * (size_t)(g_daemon.runs->runs_end - g_daemon.runs->runs_begin));
+	client->blocks_count = daemon_select_blocks(g_daemon.runs, client->selection, client->blocks);
+	client->selected = true;
+
+	output_frame_select(&client->frame, client->blocks, client->blocks_count);
+	if (!output_frame_send_header(&client->frame, client->fd)) // the rest is flushed on POLLOUT
+		return false;
+
+	if (rest_len > 0) // click events sent together with the selection
+		cevent_parser_feed(client->cevent, (const uint8_t *)rest, rest_len);
+	free(client->selection);
+	client->selection = NULL;
+	return true;
+}
+
+static bool handle_daemon_client(void *arg) {
+	struct daemon_client *client = arg;
+	if (output_frame_busy(&client->frame) && !output_frame_flush(&client->frame, client->fd)) {
+		daemon_client_close(client);
+		return false;
+	}
+
+	uint8_t input[2048];
+	const ssize_t ret = read(client->fd, input, sizeof(input));
+	if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EINTR)) {
+		daemon_client_close(client);
+		return false;
+	}
+	if (ret > 0) {
+		if (client->selected)
+			cevent_parser_feed(client->cevent, input, (size_t)ret);
+		else if (!daemon_client_selection(client, input, (size_t)ret)) {
+			daemon_client_close(client);
+			return false;
+		}
+	}
+	daemon_client_watch(client);
+	return false;
+}
+
+static bool handle_daemon_accept(void *arg) {
+	(void)arg;
+	int fd;
+	while (0 <= (fd = accept4(g_daemon.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC))) {
+		struct daemon_client *client = calloc(1, sizeof(struct daemon_client));
+		client->fd = fd;
+		client->selection = malloc(DAEMON_SELECTION_MAX + 1);
+		client->frame = (struct output_frame){.sink = g_daemon.sink};
+		client->cevent = cevent_parser_new(g_daemon.runs);
+		client->next = g_daemon.clients;
+		g_daemon.clients = client;
+		fdpoll_add(fd, handle_daemon_client, client);
+	}
+	return false;
+}
+
+static bool daemon_fill_addr(struct sockaddr_un *addr, const char *path) {
+	*addr = (struct sockaddr_un){.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "daemon: socket path too long [%s]\n", path);
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+bool daemon_init(const char *path, struct runs_list *runs, const struct output_sink *sink) {
+	struct sockaddr_un addr;
+	if (!daemon_fill_addr(&addr, path))
+		return false;
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		goto _error;
+	if (0 == connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "daemon: another daemon is already listening on %s\n", path);
+		close(fd);
+		return false;
+	}
+	unlink(path); // stale socket
+	if (0 != bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) || 0 != listen(fd, 16))
+		goto _error;
+
+	signal(SIGPIPE, SIG_IGN); // disconnected clients are handled by write errors
+	g_daemon.runs = runs;
+	g_daemon.sink = sink;
+	g_daemon.path = path;
+	g_daemon.listen_fd = fd;
+	fdpoll_add(fd, handle_daemon_accept, NULL);
+	return true;
+
+_error:
+	fprintf(stderr, "daemon: unable to listen on %s: %s\n", path, strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	return false;
+}
+
+void daemon_send(void) {
+	for (struct daemon_client *client = g_daemon.clients, *next; client; client = next) {
+		next = client->next;
+		if (!client->selected)
+			continue;
+		output_frame_select(&client->frame, client->blocks, client->blocks_count);
+		if (unlikely(!output_frame_send(&client->frame, client->fd)))
+			daemon_client_close(client);
+		else
+			daemon_client_watch(client);
+	}
+}
+
+void daemon_free(void) {
+	while (g_daemon.clients)
+		daemon_client_close(g_daemon.clients);
+	if (g_daemon.listen_fd >= 0) {
+		fdpoll_remove(g_daemon.listen_fd);
+		close(g_daemon.listen_fd);
+		unlink(g_daemon.path);
+		g_daemon.listen_fd = -1;
+	}
+}
+
+int daemon_client_run(const char *path, char *const selectors[], int count) {
+	struct sockaddr_un addr;
+	if (!daemon_fill_addr(&addr, path))
+		return 1;
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || 0 != connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "client: unable to connect to %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	for (int i = 0; i < count; ++i) {
+		if (!daemon_write_all(fd, selectors[i], strlen(selectors[i])) || !daemon_write_all(fd, "\n", 1))
+			goto _disconnected;
+	}
+	if (!daemon_write_all(fd, "\n", 1))
+		goto _disconnected;
+
+	// the daemon serves other bars too, so a hidden bar doesn't pause it
+	signal(OUTPUT_STOP_SIGNAL, SIG_IGN);
+
+	struct pollfd fds[2] = {
+		{.fd = fd, .events = POLLIN},
+		{.fd = STDIN_FILENO, .events = POLLIN}, // click events
+	};
+	char buffer[4096];
+	while (true) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[0].revents) {
+			const ssize_t len = read(fd, buffer, sizeof(buffer));
+			if (len <= 0 || !daemon_write_all(STDOUT_FILENO, buffer, (size_t)len))
+				break;
+		}
+		if (fds[1].revents) {
+			const ssize_t len = read(STDIN_FILENO, buffer, sizeof(buffer));
+			if (len <= 0)
+				fds[1].fd = -1;
+			else if (!daemon_write_all(fd, buffer, (size_t)len))
+				break;
+		}
+	}
+
+_disconnected:
+	fprintf(stderr, "client: disconnected from %s\n", path);
+	close(fd);
+	return 1;
+}
+
+#ifdef TESTS
+
+int test_daemon_select_blocks(void) {
+	static const struct cmd test_cmds[] = { { .name = "date" }, { .name = "eth" }, { .name = "load" } };
+	struct run_instance runs_arr[] = {
+		{ .vtable = test_cmds + 0 },
+		{ .vtable = test_cmds + 1, .instance = "wlan0" },
+		{ .vtable = test_cmds + 1, .instance = "eth0" },
+		{ .vtable = test_cmds + 2 },
+	};
+	struct runs_list runs = {runs_arr, runs_arr + ARRAY_SIZE(runs_arr)};
+	static const struct {
+		const char *selection;
+		unsigned count;
+		unsigned blocks[4]; ///< indexes of expected blocks
+	} tests[] = {
+		{"", 4, {0, 1, 2, 3}},
+		{"eth", 2, {1, 2}},
+		{"eth eth0\nload", 2, {2, 3}},
+		{"load\ndate", 2, {0, 3}},
+		{"eth wlan", 0, {0}},
+		{"date\nnope", 1, {0}},
+	};
+
+	struct run_instance *blocks[ARRAY_SIZE(runs_arr)];
+	for (size_t i = 0; i < ARRAY_SIZE(tests); ++i) {
+		const size_t count = daemon_select_blocks(&runs, tests[i].selection, blocks);
+		bool res = (count == tests[i].count);
+		for (size_t j = 0; res && j < count; ++j)
+			res = (blocks[j] == runs_arr + tests[i].blocks[j]);
+		if (!res) {
+			fprintf(stderr, "test_daemon_select_blocks: wrong blocks for selection [%s]\n", tests[i].selection);
+			return false;
+		}
+	}
+	return true;
+}
+
+#endif
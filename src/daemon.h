@@ -0,0 +1,55 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdbool.h>
+
+struct runs_list;
+struct output_sink;
+
+/**
+ * @brief daemon_init serve the blocks to clients connecting to the Unix socket @arg path
+ *
+ * Every connected client first sends its selection of blocks, as lines of
+ * "name" or "name instance" terminated by an empty line (an empty selection
+ * selects all blocks). Afterwards the daemon sends it the sink's header and
+ * frames, and the client can send i3bar click events.
+ */
+bool daemon_init(const char *path, struct runs_list *runs, const struct output_sink *sink);
+/**
+ * @brief daemon_send send the current frame to all clients
+ *
+ * The slots must be already updated by output_frame_update.
+ */
+void daemon_send(void);
+void daemon_free(void);
+
+/**
+ * @brief daemon_client_run connect to daemon at @arg path and relay it with stdin and stdout
+ *
+ * @param selectors blocks to select, as "name" or "name instance"
+ * @return exit code for the client process
+ */
+int daemon_client_run(const char *path, char *const selectors[], int count);
+
+#ifdef TESTS
+int test_daemon_select_blocks(void);
+#endif
+
+#endif // DAEMON_H
@@ -17,6 +17,7 @@
 
 #include "dbus_monitor.h"
 #include "fdpoll.h"
+#include "coroutine.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -66,6 +67,9 @@ void dbus_parse_arr_fields(sd_bus_message *m, void *data) {
 				case FIELD_DOUBLE:
 					sd_bus_message_read_basic(m, SD_BUS_TYPE_DOUBLE, dst);
 					break;
+				case FIELD_BOOL:
+					sd_bus_message_read_basic(m, SD_BUS_TYPE_BOOLEAN, dst);
+					break;
 				case FIELD_ARR_STR_FIRST:
 					sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "s");
 
@@ -96,15 +100,29 @@ static int dbus_monitor_systemd_handler(sd_bus_message *m, void *userdata, sd_bu
 	sd_bus_message_skip(m, NULL); // first string is the interface name - unneeded for now
 	dbus_parse_arr_fields(m, userdata);
 	const struct dbus_fields_t *const fields = ((struct dbus_monitor_base *)userdata)->fields;
-	void *data_base = (char*)userdata - fields->data_base_offset;
-	fields->func_recache(data_base);
+	struct cmd_data_base *data_base = (struct cmd_data_base *)((char*)userdata - fields->data_base_offset);
+	data_base->dirty |= fields->func_recache(data_base);
 	return 0;
 }
 
 
 static bool dbus_monitor_handler(void *data) {
-	(void)data;
-	while (0 < sd_bus_process(g_dbus_monitor_bus, NULL));
+	sd_bus *bus = data;
+	while (0 < sd_bus_process(bus, NULL));
+	return false;
+}
+
+int coroutine_dbus_reply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+	(void)ret_error;
+	struct coroutine *co = userdata;
+	co->reply = sd_bus_message_ref(m);
+	coroutine_wake(co); // resumed after sd_bus_process returns, as the body unrefs the slot
+	return 0;
+}
+
+bool coroutine_dbus_handler(void *bus) {
+	dbus_monitor_handler(bus);
+	coroutine_run_woken();
 	return false;
 }
 
@@ -114,7 +132,7 @@ static bool dbus_monitor_setup() {
 		fprintf(stderr, "dbus: Failed to connect to user bus: %s\n", strerror(-r));
 		return false;
 	}
-	fdpoll_add(sd_bus_get_fd(g_dbus_monitor_bus), dbus_monitor_handler, NULL);
+	fdpoll_add(sd_bus_get_fd(g_dbus_monitor_bus), dbus_monitor_handler, g_dbus_monitor_bus);
 	return true;
 }
 
@@ -128,3 +146,114 @@ bool dbus_add_watcher(const char *sender, const char *path, void *dst_data) {
 
 	return true;
 }
+
+struct logind_session {
+	struct dbus_monitor_base base;
+	int idle_hint;
+	int locked_hint;
+};
+
+#define LOGIND_SESSION_FIELDS(F) \
+	F("IdleHint", FIELD_BOOL, offsetof(struct logind_session, idle_hint)), \
+	F("LockedHint", FIELD_BOOL, offsetof(struct logind_session, locked_hint))
+
+DBUS_MONITOR_GEN_FIELDS(logind_session_fields, LOGIND_SESSION_FIELDS, NULL, struct logind_session, base)
+
+#define LOGIND_SERVICE "org.freedesktop.login1"
+
+static struct {
+	sd_bus *bus; ///< logind is on the system bus
+	void (*func_changed)(bool inactive);
+	struct logind_session session;
+	int sleeping;
+	char *session_path;
+	struct coroutine co; ///< finds the session and reads its state
+} g_logind = {.bus = NULL, .func_changed = NULL, .session = {.base = {&logind_session_fields}}, .sleeping = false, .session_path = NULL};
+
+static void logind_notify(void) {
+	g_logind.func_changed(g_logind.sleeping || g_logind.session.locked_hint || g_logind.session.idle_hint);
+}
+
+static int logind_session_handler(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+	(void)userdata;
+	(void)ret_error;
+	// msg format: sa{sv}as
+	sd_bus_message_skip(m, "s");
+	dbus_parse_arr_fields(m, &g_logind.session);
+	logind_notify();
+	return 0;
+}
+
+static int logind_sleep_handler(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+	(void)userdata;
+	(void)ret_error;
+	if (0 <= sd_bus_message_read_basic(m, SD_BUS_TYPE_BOOLEAN, &g_logind.sleeping))
+		logind_notify();
+	return 0;
+}
+
+/**
+ * @brief logind_check_reply check the reply of an awaited call to logind
+ */
+static bool logind_check_reply(struct coroutine *co, const char *method) {
+	if (unlikely(!co->reply))
+		fprintf(stderr, "dbus: logind %s failed to be sent\n", method);
+	else if (unlikely(sd_bus_message_is_method_error(co->reply, NULL)))
+		fprintf(stderr, "dbus: logind %s failed: %s\n", method, sd_bus_message_get_error(co->reply)->message);
+	else
+		return true;
+	return false;
+}
+
+static int logind_session_body(struct coroutine *co) {
+	const char *str;
+	int r;
+
+	CO_BEGIN(co);
+	CO_AWAIT_DBUS(co, -1, sd_bus_call_method_async(g_logind.bus, &co->slot, LOGIND_SERVICE, "/org/freedesktop/login1",
+			"org.freedesktop.login1.Manager", "GetSession",
+			coroutine_dbus_reply, co, "s", "auto"));
+	if (!logind_check_reply(co, "GetSession"))
+		goto _unref;
+	if ((r = sd_bus_message_read(co->reply, "o", &str)) < 0) {
+		fprintf(stderr, "dbus: Failed to parse logind session: %s\n", strerror(-r));
+		goto _unref;
+	}
+	g_logind.session_path = strdup(str);
+	co->reply = sd_bus_message_unref(co->reply);
+	sd_bus_match_signal_async(g_logind.bus, NULL, LOGIND_SERVICE, g_logind.session_path,
+							  "org.freedesktop.DBus.Properties", "PropertiesChanged",
+							  logind_session_handler, NULL, NULL);
+
+	CO_AWAIT_DBUS(co, -1, sd_bus_call_method_async(g_logind.bus, &co->slot, LOGIND_SERVICE, g_logind.session_path,
+			"org.freedesktop.DBus.Properties", "GetAll",
+			coroutine_dbus_reply, co, "s", "org.freedesktop.login1.Session"));
+	if (!logind_check_reply(co, "GetAll"))
+		goto _unref;
+	dbus_parse_arr_fields(co->reply, &g_logind.session);
+	if (g_logind.session.locked_hint || g_logind.session.idle_hint)
+		logind_notify();
+_unref:
+	co->reply = sd_bus_message_unref(co->reply);
+	CO_END(co);
+}
+
+bool dbus_watch_session(void (*func_changed)(bool inactive)) {
+	int r = sd_bus_open_system(&g_logind.bus);
+	if (r < 0) {
+		fprintf(stderr, "dbus: Failed to connect to system bus: %s\n", strerror(-r));
+		return false;
+	}
+	g_logind.func_changed = func_changed;
+	sd_bus_match_signal_async(g_logind.bus, NULL, LOGIND_SERVICE, "/org/freedesktop/login1",
+							  "org.freedesktop.login1.Manager", "PrepareForSleep",
+							  logind_sleep_handler, NULL, NULL);
+	fdpoll_add(sd_bus_get_fd(g_logind.bus), coroutine_dbus_handler, g_logind.bus);
+
+	// logind may be slow to answer, so the session is found without waiting
+	coroutine_init(&g_logind.co, logind_session_body, NULL);
+	coroutine_start(&g_logind.co);
+	return true;
+}
+
+#undef LOGIND_SERVICE
@@ -28,7 +28,9 @@ enum dbus_field_type {
 	FIELD_DOUBLE = 2,
 
 	FIELD_ARR_STR_FIRST = 3,
-	FIELD_ARR_DICT_EXPAND = 4
+	FIELD_ARR_DICT_EXPAND = 4,
+
+	FIELD_BOOL = 5, ///< read into int
 };
 struct dbus_field {
 	uint16_t type:3;
@@ -38,7 +40,7 @@ _Static_assert(sizeof(struct dbus_field) == 2, "incorrect bit width in struct db
 struct dbus_fields_t {
 	const char *const *const names;
 	const struct dbus_field *const opts;
-	void(*const func_recache)(struct cmd_data_base *data);
+	bool(*const func_recache)(struct cmd_data_base *data);
 	const unsigned size;
 	const unsigned data_base_offset;
 };
@@ -56,5 +58,27 @@ struct dbus_monitor_base {
 
 void dbus_parse_arr_fields(sd_bus_message *m, void *data);
 bool dbus_add_watcher(const char *sender, const char *path, void *dst_data);
+/**
+ * @brief dbus_watch_session call @arg func_changed when our session becomes inactive or active again
+ *
+ * The session is inactive while logind reports it as locked or idle, and while
+ * the system sleeps. The session is looked up without waiting for logind, and
+ * @arg func_changed is called once its state was read if already inactive.
+ *
+ * @return false if not connected to the system bus
+ */
+bool dbus_watch_session(void (*func_changed)(bool inactive));
+
+struct coroutine;
+/**
+ * @brief coroutine_dbus_reply the reply callback to pass to the call of CO_AWAIT_DBUS
+ */
+int coroutine_dbus_reply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+/**
+ * @brief coroutine_dbus_handler fdpoll callback for a bus used by coroutines
+ *
+ * Processes the bus, and then resumes the coroutines whose reply arrived.
+ */
+bool coroutine_dbus_handler(void *bus);
 
 #endif // DBUS_MONITOR_H
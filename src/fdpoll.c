@@ -14,7 +14,6 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
-
 #include "fdpoll.h"
 #include "main.h"
 
@@ -24,59 +23,294 @@
 
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
 
-struct fdpoll_data {
-	bool (*func_handle)(void *);
+#ifdef FDPOLL_EPOLL
+#include <sys/epoll.h>
+
+_Static_assert(EPOLLIN == POLLIN && EPOLLOUT == POLLOUT && EPOLLERR == POLLERR && EPOLLHUP == POLLHUP, "poll events are passed as is to epoll");
+#endif
+
+struct fdpoll_entry {
+	int fd;
+	short events;
+	bool (*func_handle)(void *); ///< NULL when removed, freed at end of fdpoll_run
 	void *data;
+	struct cmd_data_base **owners; ///< blocks to recache when func_handle returns true
+	unsigned owners_size;
+#ifdef FDPOLL_EPOLL
+	bool always_ready; ///< fd not supported by epoll (regular file), always considered ready like poll does
+#else
+	unsigned index; ///< position in g_fdpoll.fds
+#endif
 };
+
 static struct {
+	struct fdpoll_entry **by_fd; ///< lookup of entries by fd number
+	unsigned by_fd_size;
+	struct fdpoll_entry **removed; ///< entries waiting to be freed, as a handler might remove a ready fd
+	unsigned removed_size;
+#ifdef FDPOLL_EPOLL
+	int epoll_fd;
+	unsigned always_ready_count;
+#else
 	struct pollfd *fds;
-	struct fdpoll_data *data;
+	struct fdpoll_entry **entries; ///< parallel to fds, NULL for removed entries
 	unsigned size;
-} g_fdpoll = {NULL, NULL, 0};
+#endif
+} g_fdpoll = {
+	.by_fd = NULL, .by_fd_size = 0, .removed = NULL, .removed_size = 0,
+#ifdef FDPOLL_EPOLL
+	.epoll_fd = -1, .always_ready_count = 0,
+#else
+	.fds = NULL, .entries = NULL, .size = 0,
+#endif
+};
 
-void fdpoll_add(int fd, bool(*func_handle)(void *), void *data) {
-	const unsigned s = g_fdpoll.size;
-	g_fdpoll.size++;
-	g_fdpoll.fds = (struct pollfd *)realloc(g_fdpoll.fds, sizeof(struct pollfd) * g_fdpoll.size);
-	g_fdpoll.data = (struct fdpoll_data *)realloc(g_fdpoll.data, sizeof(struct fdpoll_data) * g_fdpoll.size);
+enum fdpoll_deferred_type {
+	DEFERRED_ADD,
+	DEFERRED_ADD_OWNER,
+	DEFERRED_MODIFY,
+	DEFERRED_REMOVE,
+};
+
+struct fdpoll_deferred_op {
+	enum fdpoll_deferred_type type;
+	int fd;
+	short events;
+	bool (*func_handle)(void *);
+	void *data; ///< handler's data, or the owner for DEFERRED_ADD_OWNER
+};
+
+static _Thread_local struct fdpoll_deferred *t_deferred = NULL; ///< set on threads recording their calls
+
+/**
+ * @brief fdpoll_defer record the call if the current thread defers its calls
+ *
+ * @return true if recorded, so the call shouldn't be applied now
+ */
+static bool fdpoll_defer(enum fdpoll_deferred_type type, int fd, short events, bool (*func_handle)(void *), void *data) {
+	struct fdpoll_deferred *const deferred = t_deferred;
+	if (likely(!deferred))
+		return false;
+	deferred->ops = (struct fdpoll_deferred_op *)realloc(deferred->ops, sizeof(struct fdpoll_deferred_op) * (deferred->size + 1));
+	deferred->ops[deferred->size++] = (struct fdpoll_deferred_op){
+		.type = type, .fd = fd, .events = events, .func_handle = func_handle, .data = data
+	};
+	return true;
+}
+
+void fdpoll_defer_begin(struct fdpoll_deferred *deferred) {
+	deferred->ops = NULL;
+	deferred->size = 0;
+	t_deferred = deferred;
+}
+
+void fdpoll_defer_end(void) {
+	t_deferred = NULL;
+}
+
+void fdpoll_deferred_apply(struct fdpoll_deferred *deferred) {
+	for (unsigned i = 0; i < deferred->size; i++) {
+		const struct fdpoll_deferred_op *op = deferred->ops + i;
+		switch (op->type) {
+			case DEFERRED_ADD: fdpoll_add_events(op->fd, op->events, op->func_handle, op->data); break;
+			case DEFERRED_ADD_OWNER: fdpoll_add_owner(op->fd, op->data); break;
+			case DEFERRED_MODIFY: fdpoll_modify(op->fd, op->events); break;
+			case DEFERRED_REMOVE: fdpoll_remove(op->fd); break;
+		}
+	}
+	free(deferred->ops);
+	deferred->ops = NULL;
+	deferred->size = 0;
+}
+
+static struct fdpoll_entry *fdpoll_find(int fd) {
+	if (unlikely(fd < 0 || (unsigned)fd >= g_fdpoll.by_fd_size))
+		return NULL;
+	return g_fdpoll.by_fd[fd];
+}
+
+void fdpoll_add_events(int fd, short events, bool(*func_handle)(void *), void *data) {
+	if (unlikely(fd < 0) || unlikely(fdpoll_defer(DEFERRED_ADD, fd, events, func_handle, data)))
+		return;
+	if ((unsigned)fd >= g_fdpoll.by_fd_size) {
+		const unsigned size = (unsigned)fd + 8;
+		g_fdpoll.by_fd = (struct fdpoll_entry **)realloc(g_fdpoll.by_fd, sizeof(struct fdpoll_entry *) * size);
+		memset(g_fdpoll.by_fd + g_fdpoll.by_fd_size, 0, sizeof(struct fdpoll_entry *) * (size - g_fdpoll.by_fd_size));
+		g_fdpoll.by_fd_size = size;
+	}
+	if (unlikely(g_fdpoll.by_fd[fd] != NULL))
+		fdpoll_remove(fd);
 
 	int flags;
 	if (likely(0 <= (flags = fcntl(fd, F_GETFL, 0))))
 		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 
+	struct fdpoll_entry *const entry = (struct fdpoll_entry *)malloc(sizeof(struct fdpoll_entry));
+	entry->fd = fd;
+	entry->events = events;
+	entry->func_handle = func_handle;
+	entry->data = data;
+	entry->owners = NULL;
+	entry->owners_size = 0;
+	g_fdpoll.by_fd[fd] = entry;
+
+#ifdef FDPOLL_EPOLL
+	if (unlikely(g_fdpoll.epoll_fd < 0) && unlikely(0 > (g_fdpoll.epoll_fd = epoll_create1(EPOLL_CLOEXEC))))
+		fprintf(stderr, "fdpoll: epoll_create1 failed with %s\n", strerror(errno));
+	struct epoll_event ev = {.events = (uint32_t)events, .data.ptr = entry};
+	entry->always_ready = false;
+	if (unlikely(0 != epoll_ctl(g_fdpoll.epoll_fd, EPOLL_CTL_ADD, fd, &ev))) {
+		if (errno == EPERM) {
+			entry->always_ready = true;
+			g_fdpoll.always_ready_count++;
+		} else
+			fprintf(stderr, "fdpoll: epoll_ctl for fd %d failed with %s\n", fd, strerror(errno));
+	}
+#else
+	unsigned s = 0;
+	for (; s < g_fdpoll.size && g_fdpoll.entries[s] != NULL; s++); // reuse removed entries
+	if (s == g_fdpoll.size) {
+		g_fdpoll.size++;
+		g_fdpoll.fds = (struct pollfd *)realloc(g_fdpoll.fds, sizeof(struct pollfd) * g_fdpoll.size);
+		g_fdpoll.entries = (struct fdpoll_entry **)realloc(g_fdpoll.entries, sizeof(struct fdpoll_entry *) * g_fdpoll.size);
+	}
 	g_fdpoll.fds[s].fd = fd;
-	g_fdpoll.fds[s].events = POLLIN;
+	g_fdpoll.fds[s].events = events;
 	g_fdpoll.fds[s].revents = 0;
-	g_fdpoll.data[s].data = data;
-	g_fdpoll.data[s].func_handle = func_handle;
+	g_fdpoll.entries[s] = entry;
+	entry->index = s;
+#endif
+}
+
+void fdpoll_add(int fd, bool(*func_handle)(void *), void *data) {
+	fdpoll_add_events(fd, POLLIN, func_handle, data);
+}
+
+void fdpoll_add_owner(int fd, struct cmd_data_base *owner) {
+	if (unlikely(fdpoll_defer(DEFERRED_ADD_OWNER, fd, 0, NULL, owner)))
+		return;
+	struct fdpoll_entry *const curr = fdpoll_find(fd);
+	if (unlikely(!curr))
+		return;
+	curr->owners = realloc(curr->owners, sizeof(struct cmd_data_base *) * (curr->owners_size + 1));
+	curr->owners[curr->owners_size++] = owner;
+}
+
+void fdpoll_modify(int fd, short events) {
+	if (unlikely(fdpoll_defer(DEFERRED_MODIFY, fd, events, NULL, NULL)))
+		return;
+	struct fdpoll_entry *const curr = fdpoll_find(fd);
+	if (unlikely(!curr) || curr->events == events)
+		return;
+#ifdef FDPOLL_EPOLL
+	if (curr->always_ready) {
+		curr->events = events;
+		return;
+	}
+	struct epoll_event ev = {.events = (uint32_t)events, .data.ptr = curr};
+	if (unlikely(0 != epoll_ctl(g_fdpoll.epoll_fd, EPOLL_CTL_MOD, fd, &ev)))
+		fprintf(stderr, "fdpoll: epoll_ctl for fd %d failed with %s\n", fd, strerror(errno));
+#else
+	g_fdpoll.fds[curr->index].events = events;
+#endif
+	curr->events = events;
+}
+
+void fdpoll_remove(int fd) {
+	if (unlikely(fdpoll_defer(DEFERRED_REMOVE, fd, 0, NULL, NULL)))
+		return;
+	struct fdpoll_entry *const curr = fdpoll_find(fd);
+	if (unlikely(!curr))
+		return;
+	g_fdpoll.by_fd[fd] = NULL;
+#ifdef FDPOLL_EPOLL
+	if (curr->always_ready)
+		g_fdpoll.always_ready_count--;
+	else
+		epoll_ctl(g_fdpoll.epoll_fd, EPOLL_CTL_DEL, fd, NULL); // fails harmlessly if fd was already closed
+#else
+	g_fdpoll.fds[curr->index].fd = -1;
+	g_fdpoll.fds[curr->index].revents = 0;
+	g_fdpoll.entries[curr->index] = NULL;
+#endif
+	curr->func_handle = NULL;
+	free(curr->owners);
+	curr->owners = NULL;
+	curr->owners_size = 0;
+
+	g_fdpoll.removed = (struct fdpoll_entry **)realloc(g_fdpoll.removed, sizeof(struct fdpoll_entry *) * (g_fdpoll.removed_size + 1));
+	g_fdpoll.removed[g_fdpoll.removed_size++] = curr;
 }
 
-int fdpoll_run(void) {
-	struct pollfd *const fds = g_fdpoll.fds;
+static int fdpoll_dispatch(struct fdpoll_entry *curr, unsigned revents) {
+	if (unlikely(curr->func_handle == NULL)) // removed by an earlier handler in this run
+		return 0;
+	if (revents & (unsigned)curr->events) {
+		if (curr->func_handle(curr->data) && curr->owners_size > 0) {
+			for (unsigned j = 0; j < curr->owners_size; j++)
+				curr->owners[j]->recache = true;
+			return 1;
+		}
+	} else if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+		fprintf(stderr, "fdpoll: fd %d closed\n", curr->fd);
+		fdpoll_remove(curr->fd);
+	}
+	return 0;
+}
+
+int fdpoll_run(int timeout) {
 #ifdef PROFILE
 	static int counter = 10000;
 	if ((--counter) == 0)
 		return -1;
-	int ret = poll(fds, g_fdpoll.size, 0);
-#else
-	int ret = poll(fds, g_fdpoll.size, 1000);
+	timeout = 0;
 #endif
 	int res = 0;
+#ifdef FDPOLL_EPOLL
+	struct epoll_event events[32];
+	if (unlikely(g_fdpoll.always_ready_count > 0)) {
+		for (unsigned fd = 0; fd < g_fdpoll.by_fd_size; fd++) {
+			const struct fdpoll_entry *const curr = g_fdpoll.by_fd[fd];
+			if (curr && curr->always_ready && curr->events != 0) {
+				timeout = 0;
+				break;
+			}
+		}
+	}
+	int ret = epoll_wait(g_fdpoll.epoll_fd, events, ARRAY_SIZE(events), timeout);
 	if (unlikely(ret < 0)) {
+		if (errno == EINTR)
+			return 0;
 		fprintf(stderr, "fdpoll: failed with %s\n", strerror(errno));
 		return -1;
-	} else if (ret > 0) {
-		for (unsigned i = 0; i < g_fdpoll.size; i++) {
-			if (fds[i].revents & POLLIN) {
-				if (g_fdpoll.data[i].func_handle(g_fdpoll.data[i].data))
-					res = 1;
-			} else if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
-				fprintf(stderr, "fdpoll: fd %d closed\n", fds[i].fd);
-				fds[i].fd = -1;
-			}
+	}
+	for (int i = 0; i < ret; i++)
+		res |= fdpoll_dispatch((struct fdpoll_entry *)events[i].data.ptr, events[i].events);
+	if (unlikely(g_fdpoll.always_ready_count > 0)) {
+		for (unsigned fd = 0; fd < g_fdpoll.by_fd_size; fd++) {
+			struct fdpoll_entry *const curr = g_fdpoll.by_fd[fd];
+			if (curr && curr->always_ready && curr->events != 0)
+				res |= fdpoll_dispatch(curr, (unsigned)curr->events);
 		}
 	}
+#else
+	int ret = poll(g_fdpoll.fds, g_fdpoll.size, timeout);
+	if (unlikely(ret < 0)) {
+		if (errno == EINTR)
+			return 0;
+		fprintf(stderr, "fdpoll: failed with %s\n", strerror(errno));
+		return -1;
+	}
+	if (ret > 0) {
+		for (unsigned i = 0; i < g_fdpoll.size; i++) { // handlers might add or remove fds
+			if (g_fdpoll.entries[i] != NULL && g_fdpoll.fds[i].revents != 0)
+				res |= fdpoll_dispatch(g_fdpoll.entries[i], (unsigned short)g_fdpoll.fds[i].revents);
+		}
+	}
+#endif
+	for (unsigned i = 0; i < g_fdpoll.removed_size; i++)
+		free(g_fdpoll.removed[i]);
+	g_fdpoll.removed_size = 0;
 	return res;
 }
@@ -19,15 +19,73 @@
 #define FDPOLL_H
 
 #include <stdbool.h>
+#include <poll.h>
+
+struct cmd_data_base;
 
 /**
  * @brief fdpoll_add add watch for @arg fd and call the callback function
  *
+ * The callback returns true to request recache of the blocks owning @arg fd.
+ *
  * @param fd file descriptor to watch for POLLIN events
  * @param func_handle the callback function
  * @param data arg to pass for callback function
  */
 void fdpoll_add(int fd, bool(*func_handle)(void *data), void *data);
-int fdpoll_run(void);
+/**
+ * @brief fdpoll_add_events add watch for @arg fd with custom events
+ *
+ * @param fd file descriptor to watch
+ * @param events poll events to watch for, can be 0 to watch only for errors
+ * @param func_handle the callback function
+ * @param data arg to pass for callback function
+ */
+void fdpoll_add_events(int fd, short events, bool(*func_handle)(void *data), void *data);
+/**
+ * @brief fdpoll_add_owner mark @arg owner as owning the already added @arg fd
+ *
+ * When the callback of @arg fd returns true, all its owners are marked for
+ * recache, and other blocks aren't touched.
+ */
+void fdpoll_add_owner(int fd, struct cmd_data_base *owner);
+/**
+ * @brief fdpoll_modify change the watched events of an already added @arg fd
+ */
+void fdpoll_modify(int fd, short events);
+/**
+ * @brief fdpoll_remove stop watching @arg fd
+ *
+ * Can be called from inside a callback. Doesn't close the fd.
+ */
+void fdpoll_remove(int fd);
+struct fdpoll_deferred_op;
+/**
+ * @brief fdpoll calls recorded by another thread, see fdpoll_defer_begin
+ */
+struct fdpoll_deferred {
+	struct fdpoll_deferred_op *ops;
+	unsigned size;
+};
+/**
+ * @brief fdpoll_defer_begin record the fdpoll calls of the current thread into @arg deferred
+ *
+ * fdpoll isn't thread safe, so a thread running module code (like its
+ * func_init) records its calls, and the main thread applies them later
+ * using fdpoll_deferred_apply().
+ */
+void fdpoll_defer_begin(struct fdpoll_deferred *deferred);
+void fdpoll_defer_end(void);
+/**
+ * @brief fdpoll_deferred_apply apply the recorded calls in their order, and free them
+ */
+void fdpoll_deferred_apply(struct fdpoll_deferred *deferred);
+/**
+ * @brief fdpoll_run wait for events and call the handlers of ready fds
+ *
+ * @param timeout maximal time to wait, in milliseconds
+ * @return -1 on failure, 1 if any block was marked for recache, otherwise 0
+ */
+int fdpoll_run(int timeout);
 
 #endif // FDPOLL_H
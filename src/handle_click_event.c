@@ -20,8 +20,10 @@
 
 #include <yajl/yajl_parse.h>
 
+#include <errno.h>
 #include <unistd.h>
 
+#include "handle_click_event.h"
 #include "main.h"
 #include "ini_parser.h"
 #include "fdpoll.h"
@@ -38,8 +40,7 @@ enum CURRENT_KEY {
 	CURRENT_KEY_MODIFIERS = 4, // "modifiers"
 };
 
-static struct {
-	struct runs_list *runs;
+struct cevent_parser {
 	yajl_handle yajl_parse_handle;
 
 	char *name;
@@ -47,36 +48,38 @@ static struct {
 	uint8_t button;
 	uint8_t current_key;
 	uint8_t modifiers;
-} g_cevent_data;
+};
+
+static struct runs_list *g_cevent_runs;
 
 static int cevent_integer(void *ctx, long long value) {
-	(void) ctx;
-	if (g_cevent_data.current_key == CURRENT_KEY_BUTTON)
-		g_cevent_data.button = (uint8_t)value;
+	struct cevent_parser *parser = ctx;
+	if (parser->current_key == CURRENT_KEY_BUTTON)
+		parser->button = (uint8_t)value;
 	return true;
 }
 
 static int cevent_string(void *ctx, const unsigned char *str, size_t len) {
-	(void) ctx;
+	struct cevent_parser *parser = ctx;
 	char **dst;
-	switch (g_cevent_data.current_key) {
-		case CURRENT_KEY_NAME: dst = &g_cevent_data.name; break;
-		case CURRENT_KEY_INSTANCE: dst = &g_cevent_data.instance; break;
+	switch (parser->current_key) {
+		case CURRENT_KEY_NAME: dst = &parser->name; break;
+		case CURRENT_KEY_INSTANCE: dst = &parser->instance; break;
 		case CURRENT_KEY_MODIFIERS:
 			if(0 == memcmp(str, "Shift", 5))
-				g_cevent_data.modifiers |= CEVENT_MOD_SHIFT;
+				parser->modifiers |= CEVENT_MOD_SHIFT;
 			else if(0 == memcmp(str, "Control", 7))
-				g_cevent_data.modifiers |= CEVENT_MOD_CONTROL;
+				parser->modifiers |= CEVENT_MOD_CONTROL;
 			else if(0 == memcmp(str, "Mod1", 4))
-				g_cevent_data.modifiers |= CEVENT_MOD_MOD1;
+				parser->modifiers |= CEVENT_MOD_MOD1;
 			else if(0 == memcmp(str, "Mod2", 4))
-				g_cevent_data.modifiers |= CEVENT_MOD_MOD2;
+				parser->modifiers |= CEVENT_MOD_MOD2;
 			else if(0 == memcmp(str, "Mod3", 4))
-				g_cevent_data.modifiers |= CEVENT_MOD_MOD3;
+				parser->modifiers |= CEVENT_MOD_MOD3;
 			else if(0 == memcmp(str, "Mod4", 4))
-				g_cevent_data.modifiers |= CEVENT_MOD_MOD4;
+				parser->modifiers |= CEVENT_MOD_MOD4;
 			else if(0 == memcmp(str, "Mod5", 4))
-				g_cevent_data.modifiers |= CEVENT_MOD_MOD5;
+				parser->modifiers |= CEVENT_MOD_MOD5;
 			return true;
 		default: return true;
 	}
@@ -87,25 +90,25 @@ static int cevent_string(void *ctx, const unsigned char *str, size_t len) {
 }
 
 static int cevent_map_key(void *ctx, const unsigned char *str, size_t len) {
-	(void) ctx;
-	g_cevent_data.current_key = CURRENT_KEY_UNSET;
+	struct cevent_parser *parser = ctx;
+	parser->current_key = CURRENT_KEY_UNSET;
 	switch (len) {
 		case 4:
 			if(likely(0 == memcmp(str, "name", 4)))
-				g_cevent_data.current_key = CURRENT_KEY_NAME;
+				parser->current_key = CURRENT_KEY_NAME;
 			break;
 		case 6:
 			if(likely(0 == memcmp(str, "button", 6)))
-				g_cevent_data.current_key = CURRENT_KEY_BUTTON;
+				parser->current_key = CURRENT_KEY_BUTTON;
 			break;
 		case 8:
 			if(likely(0 == memcmp(str, "instance", 8)))
-				g_cevent_data.current_key = CURRENT_KEY_INSTANCE;
+				parser->current_key = CURRENT_KEY_INSTANCE;
 			break;
 		case 9:
 			if(likely(0 == memcmp(str, "modifiers", 9))) {
-				g_cevent_data.current_key = CURRENT_KEY_MODIFIERS;
-				g_cevent_data.modifiers = 0;
+				parser->current_key = CURRENT_KEY_MODIFIERS;
+				parser->modifiers = 0;
 			}
 			break;
 	}
@@ -113,24 +116,44 @@ static int cevent_map_key(void *ctx, const unsigned char *str, size_t len) {
 }
 
 static int cevent_start_map(void *ctx) {
-	(void) ctx;
-	free(g_cevent_data.name);
-	free(g_cevent_data.instance);
-	g_cevent_data.name = NULL;
-	g_cevent_data.instance = NULL;
-	g_cevent_data.button = __CEVENT_MOUSE_UNSET;
-	g_cevent_data.current_key = CURRENT_KEY_UNSET;
+	struct cevent_parser *parser = ctx;
+	free(parser->name);
+	free(parser->instance);
+	parser->name = NULL;
+	parser->instance = NULL;
+	parser->button = __CEVENT_MOUSE_UNSET;
+	parser->current_key = CURRENT_KEY_UNSET;
 	return true;
 }
 
+/**
+ * @brief cevent_flush_wheel pass the pending wheel events of @arg run to its func_wheel
+ */
+static void cevent_flush_wheel(struct run_instance *run) {
+	if (run->wheel_steps != 0) {
+		run->vtable->func_wheel(run->data, run->wheel_steps);
+		run->wheel_steps = 0;
+	}
+}
+
 static int cevent_end_map(void *ctx) {
-	(void) ctx;
-	if (likely(g_cevent_data.name != NULL && g_cevent_data.button != __CEVENT_MOUSE_UNSET)) {
-		FOREACH_RUN(run, g_cevent_data.runs) {
-			if ((0 == strcmp(run->vtable->name, g_cevent_data.name)) &&
-					(g_cevent_data.instance == run->instance/* == NULL*/ || 0 == strcmp(run->instance, g_cevent_data.instance))) {
-				if (run->vtable->func_cevent)
-					run->vtable->func_cevent(run->data, g_cevent_data.button, g_cevent_data.modifiers);
+	struct cevent_parser *parser = ctx;
+	if (likely(parser->name != NULL && parser->button != __CEVENT_MOUSE_UNSET)) {
+		FOREACH_RUN(run, g_cevent_runs) {
+			if ((0 == strcmp(run->vtable->name, parser->name)) &&
+					(parser->instance == run->instance/* == NULL*/ || 0 == strcmp(run->instance, parser->instance))) {
+				if (!run->busy) { // busy data is owned by a worker
+					if (run->vtable->func_wheel && (parser->button == CEVENT_MOUSE_WHEEL_UP || parser->button == CEVENT_MOUSE_WHEEL_DOWN)) {
+						if (run->wheel_steps != 0)
+							++g_stats.wheel_coalesced;
+						run->wheel_steps += (parser->button == CEVENT_MOUSE_WHEEL_UP) ? 1 : -1;
+					} else if (run->vtable->func_cevent) {
+						if (run->vtable->func_wheel) // keep the order of events
+							cevent_flush_wheel(run);
+						run->vtable->func_cevent(run->data, parser->button, parser->modifiers);
+					}
+					g_frame_immediate = true;
+				}
 				break;
 			}
 		}
@@ -146,20 +169,41 @@ static const yajl_callbacks cevent_callbacks = {
 	.yajl_end_map = cevent_end_map,
 };
 
+struct cevent_parser *cevent_parser_new(struct runs_list *runs) {
+	g_cevent_runs = runs;
+	struct cevent_parser *parser = calloc(1, sizeof(struct cevent_parser));
+	parser->yajl_parse_handle = yajl_alloc(&cevent_callbacks, NULL, parser);
+	return parser;
+}
+
+void cevent_parser_feed(struct cevent_parser *parser, const uint8_t *data, size_t len) {
+	yajl_parse(parser->yajl_parse_handle, data, len);
+	FOREACH_RUN(run, g_cevent_runs) // the burst of wheel events read together is applied once
+		if (run->vtable->func_wheel)
+			cevent_flush_wheel(run);
+}
+
+void cevent_parser_free(struct cevent_parser *parser) {
+	yajl_free(parser->yajl_parse_handle);
+	free(parser->name);
+	free(parser->instance);
+	free(parser);
+}
+
 static bool handle_click_event(void *arg) {
-	(void)arg;
+	struct cevent_parser *parser = arg;
 
 	uint8_t input[2048];
 	ssize_t ret = read(STDIN_FILENO, input, sizeof(input));
 	if (likely(ret > 0))
-		yajl_parse(g_cevent_data.yajl_parse_handle, input, (size_t)ret);
-	else
+		cevent_parser_feed(parser, input, (size_t)ret);
+	else if (ret == 0 || errno != EAGAIN) {
+		fdpoll_remove(STDIN_FILENO);
 		close(STDIN_FILENO);
+	}
 	return false;
 }
 
 void init_cevent_handle(struct runs_list *runs) {
-	g_cevent_data.runs = runs;
-	g_cevent_data.yajl_parse_handle = yajl_alloc(&cevent_callbacks, NULL, NULL);
-	fdpoll_add(STDIN_FILENO, handle_click_event, NULL);
+	fdpoll_add(STDIN_FILENO, handle_click_event, cevent_parser_new(runs));
 }
@@ -0,0 +1,41 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HANDLE_CLICK_EVENT_H
+#define HANDLE_CLICK_EVENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct runs_list;
+struct cevent_parser;
+
+/**
+ * @brief cevent_parser_new create parser for a stream of i3bar click events
+ *
+ * Parsed click events are dispatched to the matching block in @arg runs.
+ */
+struct cevent_parser *cevent_parser_new(struct runs_list *runs);
+void cevent_parser_feed(struct cevent_parser *parser, const uint8_t *data, size_t len);
+void cevent_parser_free(struct cevent_parser *parser);
+
+/**
+ * @brief init_cevent_handle parse click events from stdin
+ */
+void init_cevent_handle(struct runs_list *runs);
+
+#endif // HANDLE_CLICK_EVENT_H
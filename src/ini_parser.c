@@ -141,6 +141,11 @@ static bool parse_assignment(void *cmd_data, const struct cmd_opts *cmd_opts, ch
 		} case OPT_TYPE_BYTE_THRESHOLD: {
 			*((long *)dst) = parse_human_bytes(value);
 			break;
+		} case OPT_TYPE_DURATION: {
+			char *suffix;
+			const double duration = strtod(value, &suffix);
+			*((long *)dst) = (long)(0 == strcmp(suffix, "ms") ? duration : duration * 1000);
+			break;
 		} default: __builtin_unreachable();
 	}
 
@@ -152,11 +157,17 @@ static bool parse_assignment(void *cmd_data, const struct cmd_opts *cmd_opts, ch
 	F("color_bad", OPT_TYPE_COLOR, offsetof(struct general_settings_t, color_bad)), \
 	F("color_degraded", OPT_TYPE_COLOR, offsetof(struct general_settings_t, color_degraded)), \
 	F("color_good", OPT_TYPE_COLOR, offsetof(struct general_settings_t, color_good)), \
-	F("interval", OPT_TYPE_LONG, offsetof(struct general_settings_t, interval))
+	F("cpu_budget", OPT_TYPE_DURATION, offsetof(struct general_settings_t, cpu_budget)), \
+	F("interval", OPT_TYPE_DURATION, offsetof(struct general_settings_t, interval)), \
+	F("locked_interval_factor", OPT_TYPE_LONG, offsetof(struct general_settings_t, locked_interval_factor)), \
+	F("max_fps", OPT_TYPE_LONG, offsetof(struct general_settings_t, max_fps)), \
+	F("output", OPT_TYPE_STR, offsetof(struct general_settings_t, output)), \
+	F("placeholder", OPT_TYPE_STR, offsetof(struct general_settings_t, placeholder)), \
+	F("timer_slack", OPT_TYPE_DURATION, offsetof(struct general_settings_t, timer_slack))
 CMD_OPTS_GEN_STRUCTS(general, GENERAL_OPTIONS)
 static const struct cmd_opts general_opts = CMD_OPTS_GEN_DATA(general);
 struct general_settings_t g_general_settings = {
-	.interval = 1,
+	.interval = 1000,
 	.color_bad = "#FF0000",
 	.color_degraded = "#FFFF00",
 	.color_good = "#00FF00"
@@ -209,6 +220,12 @@ struct runs_list ini_parse(const char *argv_path) {
 			curr = runs + (res_size - 1);
 			curr->vtable = cmd;
 			curr->data = calloc(cmd->data_size, 1);
+			curr->out_slot = NULL;
+			curr->out_slot_capacity = 0;
+			curr->placeholder = NULL;
+			curr->busy = false;
+			curr->starting = false;
+			curr->wheel_steps = 0;
 			if (space != ender) {
 				size_t len = strlen(space);
 				if (len > MAX_INSTANCE_LEN - 1)
@@ -238,9 +255,12 @@ _error:
 
 void free_all_run_instances(struct runs_list *runs) {
 	FOREACH_RUN(run, runs) {
-		run->vtable->func_destroy(run->data);
-		free(run->data);
+		if (likely(!run->busy)) { // a stuck worker still uses the data
+			run->vtable->func_destroy(run->data);
+			free(run->data);
+		}
 		free(run->instance);
+		free(run->out_slot);
 	}
 	free(runs->runs_begin);
 }
@@ -271,7 +291,11 @@ int test_cmd_array_correct(void) {
 			unsigned type;
 			unsigned offset;
 		} base_opts[] = {
-			{"interval", OPT_TYPE_LONG, offsetof(struct cmd_data_base, interval)},
+			{"cpu_budget", OPT_TYPE_DURATION, offsetof(struct cmd_data_base, cpu_budget)},
+			{"interval", OPT_TYPE_DURATION, offsetof(struct cmd_data_base, interval)},
+			{"max_interval", OPT_TYPE_DURATION, offsetof(struct cmd_data_base, max_interval)},
+			{"signal", OPT_TYPE_LONG, offsetof(struct cmd_data_base, signal)},
+			{"timeout", OPT_TYPE_DURATION, offsetof(struct cmd_data_base, timeout)},
 		};
 		for (size_t i = 0; i < ARRAY_SIZE(base_opts); ++i) {
 			const struct cmd_option *cmd_option = find_cmd_option(&iter->opts, base_opts[i].name);
@@ -18,6 +18,8 @@
 #ifndef INI_PARSER_H
 #define INI_PARSER_H
 
+#include <stdbool.h>
+
 struct cmd;
 struct cmd_data_base;
 
@@ -26,6 +28,16 @@ struct run_instance {
 	struct cmd_data_base *data;
 	char *instance;
 #define MAX_INSTANCE_LEN 64
+
+	char *out_slot; ///< serialized block, re-encoded only when the block is dirty
+	unsigned out_slot_len;
+	unsigned out_slot_capacity;
+	unsigned out_prefix_len; ///< length of constant start of out_slot, rendered by the output sink
+
+	struct cmd_data_base *placeholder; ///< when set, shown instead of data
+	bool busy; ///< data is owned by a worker thread, see worker_pool
+	bool starting; ///< func_init still runs on another thread, see parallel_init
+	int wheel_steps; ///< wheel events waiting for func_wheel, see cevent_parser_feed
 };
 
 struct runs_list {
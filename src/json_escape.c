@@ -0,0 +1,210 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "json_escape.h"
+#include "main.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+	#define JSON_ESCAPE_X86
+#endif
+
+/// escape char after the backslash, 'u' for \u00XX, or 0 if no escaping is needed
+static const char g_json_escape_table[256] = {
+	[0x00 ... 0x07] = 'u', ['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n',
+	[0x0B] = 'u', ['\f'] = 'f', ['\r'] = 'r', [0x0E ... 0x1F] = 'u',
+	['"'] = '"', ['\\'] = '\\',
+};
+
+static size_t json_escape_find_scalar(const char *str, size_t pos, size_t len) {
+	for (; pos < len; ++pos)
+		if (g_json_escape_table[(uint8_t)str[pos]])
+			return pos;
+	return len;
+}
+
+#ifdef JSON_ESCAPE_X86
+#ifdef __SSE2__
+static size_t json_escape_find_sse2(const char *str, size_t len) {
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i ctrl = _mm_set1_epi8(0x1F);
+	size_t pos = 0;
+	for (; pos + 16 <= len; pos += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(str + pos));
+		const __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+									   _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v)); // v <= 0x1F
+		const unsigned mask = (unsigned)_mm_movemask_epi8(m);
+		if (mask)
+			return pos + (size_t)__builtin_ctz(mask);
+	}
+	return json_escape_find_scalar(str, pos, len);
+}
+#endif
+
+__attribute__((target("avx2")))
+static size_t json_escape_find_avx2(const char *str, size_t len) {
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i ctrl = _mm256_set1_epi8(0x1F);
+	size_t pos = 0;
+	for (; pos + 32 <= len; pos += 32) {
+		const __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(str + pos));
+		const __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+										  _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctrl), v)); // v <= 0x1F
+		const unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+		if (mask)
+			return pos + (size_t)__builtin_ctz(mask);
+	}
+	return json_escape_find_scalar(str, pos, len);
+}
+#endif
+
+size_t json_escape_find(const char *str, size_t len) {
+#ifdef JSON_ESCAPE_X86
+	if (len >= 32 && __builtin_cpu_supports("avx2"))
+		return json_escape_find_avx2(str, len);
+#ifdef __SSE2__
+	if (len >= 16)
+		return json_escape_find_sse2(str, len);
+#endif
+#endif
+	return json_escape_find_scalar(str, 0, len);
+}
+
+size_t json_escape(char *dst, const char *str, size_t len) {
+	static const char hex[16] = "0123456789abcdef";
+	char *const dst_start = dst;
+	size_t pos;
+	while ((pos = json_escape_find(str, len)) != len) {
+		memcpy(dst, str, pos);
+		dst += pos;
+		const uint8_t ch = (uint8_t)str[pos];
+		const char esc = g_json_escape_table[ch];
+		*(dst++) = '\\';
+		*(dst++) = esc;
+		if (esc == 'u') {
+			*(dst++) = '0';
+			*(dst++) = '0';
+			*(dst++) = hex[ch >> 4];
+			*(dst++) = hex[ch & 0xF];
+		}
+		str += pos + 1;
+		len -= pos + 1;
+	}
+	memcpy(dst, str, len);
+	return (size_t)(dst + len - dst_start);
+}
+
+#if defined(TESTS) || defined(BENCH)
+static size_t json_escape_find_naive(const char *str, size_t len) {
+	for (size_t pos = 0; pos < len; ++pos) {
+		const uint8_t ch = (uint8_t)str[pos];
+		if (ch == '"' || ch == '\\' || ch < 0x20)
+			return pos;
+	}
+	return len;
+}
+#endif
+
+#ifdef TESTS
+
+#include <stdio.h>
+
+int test_json_escape(void) {
+#define TEST_ERR(...) ((void)fprintf(stderr, __VA_ARGS__), false)
+#define ERR_STR(str) "test_json_escape: "str"\n"
+	char buf[100];
+	for (size_t i = 0; i < sizeof(buf); ++i)
+		buf[i] = (char)(0x20 + (i * 7) % 0x60 + (i % 5 == 0 ? 0x80 : 0)); // printable and UTF-8 like bytes
+	for (size_t i = 0; i < sizeof(buf); ++i)
+		if (buf[i] == '"' || buf[i] == '\\')
+			buf[i] = 'x';
+
+	static const char specials[] = {'"', '\\', '\0', '\n', 0x1F, 0x01};
+	for (size_t len = 0; len <= sizeof(buf); ++len) {
+		if (json_escape_find(buf, len) != len)
+			return TEST_ERR(ERR_STR("false positive for length %zu"), len);
+		for (size_t pos = 0; pos < len; ++pos) {
+			for (size_t s = 0; s < sizeof(specials); ++s) {
+				const char orig = buf[pos];
+				buf[pos] = specials[s];
+				const size_t res = json_escape_find(buf, len);
+				buf[pos] = orig;
+				if (res != pos)
+					return TEST_ERR(ERR_STR("char 0x%02x at %zu of %zu found at %zu"), specials[s], pos, len, res);
+			}
+		}
+	}
+	for (unsigned ch = 0; ch < 256; ++ch) {
+		const char c = (char)ch;
+		if ((json_escape_find(&c, 1) == 0) != (json_escape_find_naive(&c, 1) == 0))
+			return TEST_ERR(ERR_STR("mismatch with naive for char 0x%02x"), ch);
+	}
+
+	static const char input[] = "a\"b\\c\nd\te\x01" "f/\xd7\xa9";
+	static const char expected[] = "a\\\"b\\\\c\\nd\\te\\u0001f/\xd7\xa9";
+	char out[JSON_ESCAPE_MAX_LEN(sizeof(input))];
+	const size_t out_len = json_escape(out, input, X_STRLEN(input));
+	if (out_len != X_STRLEN(expected) || 0 != memcmp(out, expected, out_len))
+		return TEST_ERR(ERR_STR("incorrect escaped output [%.*s]"), (int)out_len, out);
+	return true;
+#undef ERR_STR
+#undef TEST_ERR
+}
+
+#endif
+
+#ifdef BENCH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double bench_json_escape_run(size_t (*func)(const char *, size_t), const char *str, size_t len, unsigned rounds) {
+	struct timespec start, end;
+	size_t sum = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned i = 0; i < rounds; ++i) {
+		sum += func(str, len);
+		__asm__ volatile("" : : "r"(str) : "memory"); // don't let the compiler hoist the call
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (sum != (size_t)rounds * len)
+		fputs("bench_json_escape: unexpected result\n", stderr);
+	return ((double)(end.tv_sec - start.tv_sec) * 1e9 + (double)(end.tv_nsec - start.tv_nsec)) / rounds;
+}
+
+void bench_json_escape(void) {
+	static const size_t lens[] = {16, 64, 256, 4096};
+	char *str = malloc(4096);
+	for (size_t i = 0; i < 4096; ++i)
+		str[i] = (char)('a' + i % 26);
+	for (size_t i = 0; i < ARRAY_SIZE(lens); ++i) {
+		const unsigned rounds = (unsigned)(64 * 1024 * 1024 / lens[i]);
+		const double naive = bench_json_escape_run(json_escape_find_naive, str, lens[i], rounds);
+		const double simd = bench_json_escape_run(json_escape_find, str, lens[i], rounds);
+		fprintf(stderr, "bench_json_escape: len=%4zu naive=%8.1fns simd=%8.1fns speedup=%.1fx\n",
+				lens[i], naive, simd, naive / simd);
+	}
+	free(str);
+}
+
+#endif
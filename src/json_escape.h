@@ -0,0 +1,49 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JSON_ESCAPE_H
+#define JSON_ESCAPE_H
+
+#include <stddef.h>
+
+/// worst case length of escaped string, when all chars are escaped as \u00XX
+#define JSON_ESCAPE_MAX_LEN(len) ((len) * 6)
+
+/**
+ * @brief json_escape_find find the first char that must be escaped inside a JSON string
+ *
+ * Uses SSE2/AVX2 when available, scanning 16/32 bytes at a time.
+ *
+ * @return index of the first such char, or @arg len if the string is safe as is
+ */
+size_t json_escape_find(const char *str, size_t len);
+/**
+ * @brief json_escape write escaped @arg str into @arg dst
+ *
+ * @param dst buffer of at least JSON_ESCAPE_MAX_LEN(len) bytes
+ * @return the length of the escaped string
+ */
+size_t json_escape(char *dst, const char *str, size_t len);
+
+#ifdef TESTS
+int test_json_escape(void);
+#endif
+#ifdef BENCH
+void bench_json_escape(void);
+#endif
+
+#endif // JSON_ESCAPE_H
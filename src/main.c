@@ -21,100 +21,440 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
 #include "main.h"
 #include "ini_parser.h"
 #include "fdpoll.h"
+#include "output.h"
+#include "json_escape.h"
+#include "vprint.h"
+#include "handle_click_event.h"
+#include "daemon.h"
+#include "scheduler.h"
+#include "read_batch.h"
+#include "worker_pool.h"
+#include "budget.h"
+#include "coroutine.h"
+#include "parallel_init.h"
+#ifdef HAVE_LOGIND
+#include "dbus_monitor.h"
+#endif
+
+struct stats_t g_stats = {0};
+bool g_frame_immediate = false;
+static long g_start_ms; ///< monotonic time of start, for the time to first frame
+static bool g_init_failed = false;
+
+static void stats_print(void) {
+	fprintf(stderr, "stats: frames_sent=%lu frames_suppressed=%lu frames_dropped=%lu frames_coalesced=%lu wheel_coalesced=%lu\n",
+			g_stats.frames_sent, g_stats.frames_suppressed, g_stats.frames_dropped, g_stats.frames_coalesced,
+			g_stats.wheel_coalesced);
+	fprintf(stderr, "stats: first_frame_ms=%ld ready_ms=%ld\n", g_stats.first_frame_ms, g_stats.ready_ms);
+	budget_stats_print();
+}
+
+static struct {
+	bool paused; ///< the bar is hidden, so nothing is refreshed
+	bool inactive; ///< the session is locked, idle or sleeping
+	bool resumed; ///< the bar was shown again, or session became active, so everything is refreshed once
+} g_bar_state = {false, false, false};
+
+/**
+ * @brief bar_suspended whether timed refreshes and frames are currently suspended
+ */
+static inline bool bar_suspended(void) {
+	return g_bar_state.paused || (g_bar_state.inactive && g_general_settings.locked_interval_factor <= 0);
+}
+
+#ifdef HAVE_LOGIND
+static void handle_session_changed(bool inactive) {
+	g_bar_state.resumed |= (g_bar_state.inactive && !inactive);
+	g_bar_state.inactive = inactive;
+}
+#endif
+
+static struct runs_list *g_signal_runs; ///< blocks which may be bound to a real-time signal
+
+static bool handle_signal(void *arg) {
+	const int fd = (int)(intptr_t)arg;
+	struct signalfd_siginfo info;
+	while (sizeof(info) == read(fd, &info, sizeof(info))) {
+		switch (info.ssi_signo) {
+			case SIGUSR1:
+				stats_print();
+				break;
+			case OUTPUT_STOP_SIGNAL:
+				g_bar_state.paused = true;
+				break;
+			case OUTPUT_CONT_SIGNAL:
+				g_bar_state.resumed |= g_bar_state.paused;
+				g_bar_state.paused = false;
+				break;
+			default: {
+				const long sig = (long)info.ssi_signo - SIGRTMIN;
+				FOREACH_RUN(run, g_signal_runs)
+					if (run->data->signal == sig)
+						run->data->recache = true;
+				break;
+			}
+		}
+	}
+	return false;
+}
+
+static void init_signals(struct runs_list *runs) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, OUTPUT_STOP_SIGNAL);
+	sigaddset(&mask, OUTPUT_CONT_SIGNAL);
+	FOREACH_RUN(run, runs)
+		if (run->data->signal > 0)
+			sigaddset(&mask, SIGRTMIN + (int)run->data->signal);
+	g_signal_runs = runs;
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	const int fd = signalfd(-1, &mask, SFD_CLOEXEC);
+	if (likely(fd >= 0))
+		fdpoll_add(fd, handle_signal, (void *)(intptr_t)fd);
+}
+
+/**
+ * @brief schedule_run schedule the next recache of the block
+ *
+ * @param prev_deadline the deadline of the last recache, to keep the block's cadence; -1 if none
+ */
+static void schedule_run(struct scheduler *sched, struct run_instance *run, long now, long prev_deadline) {
+	long interval = run->data->interval;
+	if (run->data->max_interval > interval && run->data->adaptive_interval > interval)
+		interval = run->data->adaptive_interval;
+	interval = budget_interval(run, interval);
+	const long next_update = run->busy ? 0 : run->data->next_update; // busy data may be changing
+	if (next_update > 0 && (interval <= 0 || next_update < interval)) {
+		scheduler_push(sched, run, now + next_update);
+		return;
+	} else if (interval <= 0)
+		return;
+	if (unlikely(g_bar_state.inactive) && g_general_settings.locked_interval_factor > 0) // slow down instead of suspending
+		interval *= g_general_settings.locked_interval_factor;
+	const bool cadence = prev_deadline >= 0 && prev_deadline + interval > now;
+	long deadline = cadence ? prev_deadline + interval : now + interval;
+	if (interval % 1000 == 0) {
+		const long aligned = scheduler_align_second(deadline);
+		// a new cadence starts at the boundary before, so the first refresh doesn't skip a second
+		deadline = (!cadence && aligned > deadline + 1) ? aligned - 1000 : aligned;
+		if (unlikely(deadline <= prev_deadline)) // the clock stepped back, don't refresh twice in a row
+			deadline = prev_deadline + interval;
+	}
+	scheduler_push(sched, run, deadline);
+}
 
-void init_cevent_handle(struct runs_list *runs);
+/**
+ * @brief refresh_all recache all blocks once and restart their schedule, after the bar was hidden
+ */
+static void refresh_all(struct scheduler *sched, struct runs_list *runs, long now) {
+	scheduler_clear(sched);
+	FOREACH_RUN(run, runs) {
+		if (run->starting) // scheduled once its init is done
+			continue;
+		run->data->recache = true;
+		schedule_run(sched, run, now, -1);
+	}
+}
+
+/**
+ * @brief run_started finish the start of a block once its init is done, and refresh it for the first time
+ */
+static void run_started(struct scheduler *sched, struct run_instance *run) {
+	if (run->data->interval == 0)
+		run->data->interval = g_general_settings.interval;
+	if (run->vtable->recache_blocking)
+		worker_pool_submit(run, monotonic_ms());
+	else
+		budget_recache(run);
+	schedule_run(sched, run, monotonic_ms(), -1);
+}
+
+static void handle_run_ready(struct run_instance *run, bool success, void *arg) {
+	if (unlikely(!success)) {
+		fprintf(stderr, "init for %s:%s failed\n", run->vtable->name, run->instance);
+		g_init_failed = true;
+		return;
+	}
+	run_started((struct scheduler *)arg, run);
+	g_stats.ready_ms = monotonic_ms() - g_start_ms; // the last block to be ready sets it
+}
+
+/**
+ * @brief next_wakeup the earliest deadline to wake up for, or -1 if there is none
+ */
+static long next_wakeup(const struct scheduler *sched, long flush_deadline) {
+	long deadline = scheduler_next_deadline(sched);
+	if (flush_deadline >= 0 && (deadline < 0 || flush_deadline < deadline))
+		deadline = flush_deadline;
+	const long worker_deadline = worker_pool_next_deadline();
+	if (worker_deadline >= 0 && (deadline < 0 || worker_deadline < deadline))
+		deadline = worker_deadline;
+	return deadline;
+}
+
+static struct {
+	int fd;
+	long armed; ///< deadline the timer is set to, -1 when disarmed
+} g_wakeup_timer = {-1, -1};
+
+static bool handle_wakeup_timer(void *arg) {
+	(void)arg;
+	uint64_t expirations;
+	if (likely(0 < read(g_wakeup_timer.fd, &expirations, sizeof(expirations))))
+		g_wakeup_timer.armed = -1;
+	return false;
+}
+
+static void init_wakeup_timer(void) {
+	if (g_general_settings.timer_slack > 0 &&
+			unlikely(0 > prctl(PR_SET_TIMERSLACK, (unsigned long)g_general_settings.timer_slack * 1000000UL)))
+		fprintf(stderr, "main: unable to set timer slack: %s\n", strerror(errno));
+	g_wakeup_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (likely(g_wakeup_timer.fd >= 0))
+		fdpoll_add(g_wakeup_timer.fd, handle_wakeup_timer, NULL);
+}
+
+/**
+ * @brief wakeup_timeout arm the wakeup timer at the absolute @arg deadline
+ *
+ * Without a deadline nothing is armed, so idle waits without any wakeups.
+ *
+ * @return timeout for fdpoll_run, infinite unless the timer is unavailable
+ */
+static int wakeup_timeout(long deadline) {
+	if (unlikely(g_wakeup_timer.fd < 0)) {
+		if (deadline < 0)
+			return -1;
+		const long timeout = deadline - monotonic_ms();
+		return (int)(timeout > 0 ? timeout : 0);
+	}
+	if (deadline != g_wakeup_timer.armed) {
+		struct itimerspec spec = {0}; // zero disarms the timer
+		if (deadline >= 0) {
+			spec.it_value.tv_sec = deadline / 1000;
+			spec.it_value.tv_nsec = (deadline % 1000) * 1000000 + 1; // non zero even for deadline 0
+		}
+		if (likely(0 == timerfd_settime(g_wakeup_timer.fd, TFD_TIMER_ABSTIME, &spec, NULL)))
+			g_wakeup_timer.armed = deadline;
+	}
+	return -1;
+}
+
+static bool handle_output_writable(void *arg) {
+	struct output_frame *frame = arg;
+	if (unlikely(!output_frame_flush(frame, STDOUT_FILENO)))
+		fprintf(stderr, "main: unable to send output: %s\n", strerror(errno));
+	if (!output_frame_busy(frame))
+		fdpoll_modify(STDOUT_FILENO, 0);
+	return false;
+}
 
 int main(int argc, char *argv[]) {
 #ifdef TESTS
 	if (!test_cmd_array_correct())
 		return 1;
+	if (!test_json_escape())
+		return 1;
+	if (!test_vprint_width())
+		return 1;
+	if (!test_output_frame())
+		return 1;
+	if (!test_daemon_select_blocks())
+		return 1;
+	if (!test_scheduler())
+		return 1;
+	if (!test_worker_queue())
+		return 1;
+	if (!test_read_batch())
+		return 1;
+	if (!test_coroutine())
+		return 1;
 #endif
+#ifdef BENCH
+	bench_json_escape();
+	return 0;
+#endif
+	g_start_ms = monotonic_ms();
+	g_stats.first_frame_ms = -1;
+	if (argc > 2 && 0 == strcmp(argv[1], "--client"))
+		return daemon_client_run(argv[2], argv + 3, argc - 3);
+	const char *daemon_path = NULL;
+	if (argc > 2 && 0 == strcmp(argv[1], "--daemon")) {
+		daemon_path = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+
 	struct runs_list runs = ini_parse(argc > 1 ? argv[1] : NULL);
 	if (runs.runs_begin == NULL) {
 		fprintf(stderr, "Couldn't load config file\n");
 		return 1;
 	}
+	struct output_frame frame;
+	if (!output_frame_init(&frame, g_general_settings.output)) {
+		fprintf(stderr, "Unknown output [%s]\n", g_general_settings.output);
+		return 1;
+	}
+	free(g_general_settings.output);
+	g_general_settings.output = NULL;
+	FOREACH_RUN(run, &runs)
+		output_prepare_run(&frame, run);
 
 	if (g_general_settings.interval <= 0)
-		g_general_settings.interval = 1;
+		g_general_settings.interval = 1000;
+	struct scheduler sched = {0};
+	FOREACH_RUN(run, &runs) {
+		if (run->data->signal < 0 || run->data->signal > SIGRTMAX - SIGRTMIN) {
+			fprintf(stderr, "signal for %s:%s must be between 1 and %d\n", run->vtable->name, run->instance, SIGRTMAX - SIGRTMIN);
+			return 1;
+		}
+	}
 	FOREACH_RUN(run, &runs) {
 		if (!run->vtable->func_init(run->data)) {
 			fprintf(stderr, "init for %s:%s failed\n", run->vtable->name, run->instance);
 			return 1;
 		}
-		run->vtable->func_recache(run->data);
-		if (run->data->interval >= 0 && run->data->interval < g_general_settings.interval)
+		if (run->data->interval == 0)
 			run->data->interval = g_general_settings.interval;
 	}
+	if (!parallel_init_start(&runs, handle_run_ready, &sched))
+		return 1;
+	if (!worker_pool_init(&runs))
+		return 1;
+	budget_init(&runs);
+	FOREACH_RUN(run, &runs)
+		if (!run->starting)
+			run_started(&sched, run);
+	g_stats.ready_ms = monotonic_ms() - g_start_ms;
 
+	if (daemon_path) {
+		if (!daemon_init(daemon_path, &runs, frame.sink))
+			return 1;
+		output_frame_update(&frame, &runs); // clients may connect before the first frame
+	} else {
 #define WRITE_LEN(str) write(STDOUT_FILENO, str, strlen(str))
-	if (unlikely(0 > WRITE_LEN("{\"version\":1, \"click_events\": true}\n[\n[]\n"))) {
-		fprintf(stderr, "unable to send start status bar\n");
-		return 1;
-	}
+		if (unlikely(0 > WRITE_LEN(frame.sink->header))) {
+			fprintf(stderr, "unable to send start status bar\n");
+			return 1;
+		}
 #undef WRITE_LEN
 
-	init_cevent_handle(&runs);
+		init_cevent_handle(&runs);
+		fdpoll_add_events(STDOUT_FILENO, 0, handle_output_writable, &frame); // sets non-blocking, POLLOUT only when needed
+	}
+	init_signals(&runs);
+#ifdef HAVE_LOGIND
+	dbus_watch_session(handle_session_changed);
+#endif
+	init_wakeup_timer();
 
-	char output_buffer[4096] = ",[";
-	int fdpoll_res;
-	for (unsigned eventNum = 0; (fdpoll_res = fdpoll_run()) >= 0; ++eventNum) {
-		char *ptr = output_buffer + 2;
-		FOREACH_RUN(run, &runs) {
-			if ((fdpoll_res > 0) || (run->data->interval > 0 && eventNum % run->data->interval == 0))
-				run->vtable->func_recache(run->data);
-
-			if (run != runs.runs_begin) // separator before all except first
-				*(ptr++) = ',';
-			size_t len;
-#define OUTPUT_CONST_STR(str) memcpy(ptr, str, strlen(str)); ptr += strlen(str)
-			OUTPUT_CONST_STR("{\"name\":\"");
-			len = strlen(run->vtable->name);
-			memcpy(ptr, run->vtable->name, len);
-			ptr += len;
-
-			OUTPUT_CONST_STR("\",\"markup\":\"none");
-
-			if (run->instance) {
-				OUTPUT_CONST_STR("\",\"instance\":\"");
-				len = strlen(run->instance);
-				memcpy(ptr, run->instance, len);
-				ptr += len;
-			}
+	const unsigned runs_count = (unsigned)(runs.runs_end - runs.runs_begin);
+	struct scheduler_entry *due = malloc(sizeof(struct scheduler_entry) * runs_count);
+	struct read_batch **due_reads = malloc(sizeof(struct read_batch *) * runs_count);
 
-			if (likely(run->data->cached_fulltext)) {
-				len = strlen(run->data->cached_fulltext);
-				if (likely(output_buffer + (sizeof(output_buffer) - 256) >  ptr + len)) {
-					OUTPUT_CONST_STR("\",\"full_text\":\"");
-					memcpy(ptr, run->data->cached_fulltext, len);
-					ptr += len;
-				} else {
-					*(ptr++) = '}';
-					break;
+	const long frame_spacing = g_general_settings.max_fps > 0 ? 1000 / g_general_settings.max_fps : 0;
+	long last_frame = 0, flush_deadline = 0; // first frame is sent without waiting
+	bool dirty = true; // first frame is always sent
+	int res = 0;
+	while (fdpoll_run(wakeup_timeout(bar_suspended() ? -1 : next_wakeup(&sched, flush_deadline))) >= 0) {
+		if (unlikely(g_init_failed)) {
+			res = 1;
+			break;
+		}
+		if (unlikely(bar_suspended())) // only drain the events, and resync once shown
+			continue;
+		const long now = monotonic_ms();
+		if (unlikely(g_bar_state.resumed)) {
+			g_bar_state.resumed = false;
+			refresh_all(&sched, &runs, now);
+			g_frame_immediate = true;
+		}
+		unsigned due_count = 0, due_reads_count = 0;
+		while (due_count < runs_count && (due[due_count].run = scheduler_pop_due(&sched, now, &due[due_count].deadline))) {
+			if (due[due_count].run->data->read_batch)
+				due_reads[due_reads_count++] = due[due_count].run->data->read_batch;
+			due_count++;
+		}
+		read_batch_prefetch(due_reads, due_reads_count);
+		for (unsigned i = 0; i < due_count; i++) {
+			struct run_instance *run = due[i].run;
+			if (run->vtable->recache_blocking)
+				worker_pool_submit(run, now);
+			else {
+				run->data->next_update = 0;
+				const bool changed = budget_recache(run);
+				run->data->dirty |= changed;
+				cmd_adapt_interval(run->data, changed);
+				budget_charge(run, now);
+			}
+			schedule_run(&sched, run, now, due[i].deadline);
+		}
+		FOREACH_RUN(run, &runs) {
+			if (run->data->recache && !run->starting) {
+				run->data->recache = false;
+				if (run->vtable->recache_blocking)
+					worker_pool_submit(run, now);
+				else {
+					if (budget_recache(run)) {
+						run->data->dirty = true;
+						cmd_adapt_interval(run->data, true);
+					}
+					budget_charge(run, now);
 				}
 			}
-
-			if (run->data->cached_color[0]) {
-				OUTPUT_CONST_STR("\",\"color\":\"");
-				memcpy(ptr, run->data->cached_color, 8);
-				ptr += 7;
+			dirty |= run->data->dirty;
+		}
+		dirty |= worker_pool_expire(now);
+		if (!dirty) {
+			++g_stats.frames_suppressed;
+			continue;
+		}
+		if (frame_spacing > 0) {
+			if (last_frame + frame_spacing > now && !g_frame_immediate) { // coalesce, and flush on the trailing edge
+				++g_stats.frames_coalesced;
+				flush_deadline = last_frame + frame_spacing;
+				continue;
 			}
-			*(ptr++) = '\"';
-			*(ptr++) = '}';
-#undef OUTPUT_CONST_STR
+			last_frame = now;
 		}
-		*(ptr++) = ']';
-		*(ptr++) = '\n';
+		flush_deadline = -1;
+		g_frame_immediate = false;
 
-		if (unlikely(0 > write(STDOUT_FILENO, output_buffer, (size_t)(ptr - output_buffer)))) {
-			fprintf(stderr, "main: unable to send output: %s\n", strerror(errno));
+		output_frame_update(&frame, &runs);
+		if (daemon_path)
+			daemon_send();
+		else {
+			if (unlikely(!output_frame_send(&frame, STDOUT_FILENO)))
+				fprintf(stderr, "main: unable to send output: %s\n", strerror(errno));
+			if (output_frame_busy(&frame))
+				fdpoll_modify(STDOUT_FILENO, POLLOUT);
 		}
+		if (unlikely(g_stats.first_frame_ms < 0))
+			g_stats.first_frame_ms = monotonic_ms() - g_start_ms;
+		dirty = false;
 	}
 
+#ifdef PROFILE
+	stats_print();
+#endif
+	daemon_free();
+	worker_pool_free();
+	parallel_init_free();
+	free(g_general_settings.placeholder);
+	free(due);
+	free(due_reads);
+	read_batch_free();
+	scheduler_free(&sched);
+	output_frame_free(&frame);
 	free_all_run_instances(&runs);
-	return 0;
+	return res;
 }
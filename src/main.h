@@ -21,14 +21,34 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
 
 extern struct general_settings_t {
-	long interval;
+	long cpu_budget; ///< milliseconds of CPU time per second all blocks may use together, 0 for unlimited
+	long interval; ///< default interval of blocks, in milliseconds
+	long locked_interval_factor; ///< multiplies intervals while the session is locked or idle, 0 to suspend
+	long max_fps; ///< maximal frames per second, 0 for unlimited
+	long timer_slack; ///< milliseconds the kernel may delay our wakeups to merge them, 0 for default
+	char *output; ///< name of output sink, NULL for i3bar
+	char *placeholder; ///< text shown by blocks until their deferred init is done
 	char color_bad[8];
 	char color_degraded[8];
 	char color_good[8];
 } g_general_settings;
 
+extern struct stats_t {
+	unsigned long frames_sent;
+	unsigned long frames_suppressed; ///< wakeups in which no block changed, so no frame was sent
+	unsigned long frames_dropped; ///< frames replaced by a newer one while the output was blocked
+	unsigned long frames_coalesced; ///< frames merged into a later one because of max_fps
+	unsigned long wheel_coalesced; ///< wheel events merged into another one of the same burst
+	long first_frame_ms; ///< milliseconds from start until the first frame was sent
+	long ready_ms; ///< milliseconds from start until all blocks finished their init
+} g_stats;
+
+/// set by click events, so the next frame isn't delayed by max_fps
+extern bool g_frame_immediate;
+
 enum cmd_option_type {
 	OPT_TYPE_LONG = 0, ///< regular long variable
 	OPT_TYPE_STR = 1, ///< malloced char *
@@ -39,10 +59,15 @@ enum cmd_option_type {
 	  *  otherwise the suffix should be a byte suffix (ex. MB, GiB) and would be positive
 	  */
 	OPT_TYPE_BYTE_THRESHOLD = 3,
+	/**
+	  * should be a long variable, parsed as milliseconds: the value is in
+	  * seconds (can be fractional), unless it has a "ms" suffix
+	  */
+	OPT_TYPE_DURATION = 4,
 };
 struct cmd_option {
-	uint16_t type:2;
-	uint16_t offset:14;
+	uint16_t type:3;
+	uint16_t offset:13;
 };
 _Static_assert(sizeof(struct cmd_option) == 2, "incorrect bit width in struct cmd_option");
 #define CMD_IMPL_OPTS_GEN_NAME(name, ...) name
@@ -62,10 +87,35 @@ struct cmd_opts {
 	const unsigned size;
 } __attribute__((packed));
 
+struct read_batch;
+
+/**
+ * @brief measured cost of a block's func_recache, see budget_recache
+ */
+struct recache_cost {
+	unsigned long cpu_us; ///< total CPU time spent in func_recache, in microseconds
+	unsigned long wall_us; ///< total wall time spent in func_recache, in microseconds
+	unsigned long last_us; ///< cost charged for the last recache
+	unsigned long count; ///< number of measured recaches
+	unsigned long throttled; ///< times the block was backed off for exceeding a budget
+	unsigned backoff; ///< the interval is multiplied by 2^backoff
+};
+
 struct cmd_data_base {
-	long interval;
+	long interval; ///< milliseconds between recaches, negative for never
+	long max_interval; ///< if above interval, the interval stretches up to it while the output is unchanged
+	long adaptive_interval; ///< current stretched interval, see cmd_adapt_interval
+	long next_update; ///< can be set by func_recache, to recache again in at most these milliseconds
+	long timeout; ///< milliseconds to wait for a blocking func_recache before showing the block as stale
+	long cpu_budget; ///< milliseconds of CPU time per second the block may use before being backed off, 0 for unlimited
+	struct recache_cost cost;
+	long signal; ///< recache when SIGRTMIN+signal is received, 0 for none
 	char *cached_fulltext;
+	unsigned cached_fulltext_len;
 	char cached_color[8];
+	bool dirty; ///< cached output changed since last sent frame
+	bool recache; ///< an owned fd requested recache, see fdpoll_add_owner
+	struct read_batch *read_batch; ///< optional, set by func_init to prefetch its read before recache
 };
 
 enum click_event {
@@ -89,14 +139,39 @@ enum click_event_modifiers {
 #define CMD_USE_ALIGNMENT 8
 struct cmd {
 	const char *const name; ///< name of module
-	void(*func_recache)(struct cmd_data_base *data);
+	/**
+	 * @brief Refresh the cached output of the instance
+	 *
+	 * @return true if the cached text or color was changed
+	 */
+	bool(*func_recache)(struct cmd_data_base *data);
 	void(*func_cevent)(struct cmd_data_base *data, unsigned event, unsigned modifiers);
+	/**
+	 * @brief Apply a burst of mouse wheel events at once
+	 *
+	 * Optional. When set, wheel events read together are summed and passed
+	 * here instead of to func_cevent, so the value is changed only once.
+	 *
+	 * @param steps wheel up events minus wheel down events, never 0
+	 */
+	void(*func_wheel)(struct cmd_data_base *data, int steps);
 	/**
 	 * @brief Initialize the instance
 	 *
-	 * This function is called after config was loaded and before all other module's functions
+	 * This function is called after config was loaded and before all other module's functions.
+	 * When func_init_deferred is set, it should only validate the config and
+	 * reserve resources, as it delays the first frame.
 	 */
 	bool(*func_init)(struct cmd_data_base *data);
+	/**
+	 * @brief Finish the expensive part of the initialization
+	 *
+	 * Optional. Called on its own thread after func_init, so it might block
+	 * for long but must not use shared state. Until it is done the block
+	 * shows the placeholder, and other functions, except func_destroy, are
+	 * called only after it succeeded.
+	 */
+	bool(*func_init_deferred)(struct cmd_data_base *data);
 	/**
 	 * @brief Free all resources used in data
 	 *
@@ -106,11 +181,67 @@ struct cmd {
 
 	const struct cmd_opts opts;
 	const unsigned data_size; ///< size of module's data, which is allocated and set before call to func_init
+	const bool recache_blocking; ///< func_recache might block for long, so it is run on the worker pool
 } __attribute__ ((aligned (CMD_USE_ALIGNMENT)));
 #define DECLARE_CMD(name) static const struct cmd name __attribute__((used, section("cmd_array"), aligned(CMD_USE_ALIGNMENT)))
 
-#define CMD_COLOR_SET(data, color) memcpy((data)->base.cached_color, (color), 8)
-#define CMD_COLOR_CLEAN(data) (data)->base.cached_color[0] = '\0'
+/**
+ * @brief cmd_adapt_interval stretch the interval of a block whose output didn't change
+ *
+ * The interval is doubled on each unchanged recache up to max_interval, and
+ * drops back to interval as soon as the output changes.
+ */
+static inline void cmd_adapt_interval(struct cmd_data_base *base, bool changed) {
+	if (base->interval <= 0 || base->max_interval <= base->interval)
+		return;
+	if (changed || base->adaptive_interval < base->interval)
+		base->adaptive_interval = base->interval;
+	else if (base->adaptive_interval < base->max_interval)
+		base->adaptive_interval = (base->adaptive_interval > base->max_interval / 2) ? base->max_interval : base->adaptive_interval * 2;
+}
+
+static inline bool cmd_cache_color(char *cached, const char *color) {
+	const size_t len = color[0] ? 8 : 1;
+	if (0 == memcmp(cached, color, len))
+		return false;
+	memcpy(cached, color, len);
+	return true;
+}
+
+/**
+ * @brief cmd_cache_text copy rendered text into the instance's cached text
+ *
+ * @param text the rendered text, doesn't need to be null terminated
+ * @param len length of the rendered text, must be smaller than the cached buffer
+ * @return true if the cached text was changed
+ */
+static inline bool cmd_cache_text(struct cmd_data_base *base, const char *text, size_t len) {
+	char *cached = base->cached_fulltext;
+	if (cached[len] == '\0' && 0 == memcmp(cached, text, len))
+		return false;
+	memcpy(cached, text, len);
+	cached[len] = '\0';
+	base->cached_fulltext_len = (unsigned)len;
+	return true;
+}
+
+/**
+ * @brief cmd_cache_text_ptr point the instance's cached text to a constant string
+ *
+ * @return true if the cached text was changed
+ */
+static inline bool cmd_cache_text_ptr(struct cmd_data_base *base, char *text) {
+	if (base->cached_fulltext == text)
+		return false;
+	base->cached_fulltext = text;
+	base->cached_fulltext_len = text ? (unsigned)strlen(text) : 0;
+	return true;
+}
+
+#define CMD_COLOR_SET(data, color) cmd_cache_color((data)->base.cached_color, (color))
+#define CMD_COLOR_CLEAN(data) cmd_cache_color((data)->base.cached_color, "")
+#define CMD_TEXT_SET(data, text, len) cmd_cache_text(&(data)->base, (text), (len))
+#define CMD_TEXT_PTR_SET(data, text) cmd_cache_text_ptr(&(data)->base, (text))
 
 #define X_STRLEN(str) ((sizeof(str)/sizeof(*(str)))-sizeof(*(str)))
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
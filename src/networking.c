@@ -51,7 +51,7 @@ _Static_assert(STDIN_FILENO == 0, "look at comment");
 
 static bool handle_netlink_read(void *arg);
 
-unsigned net_add_if(const char *if_name) {
+unsigned net_add_if(const char *if_name, struct cmd_data_base *owner) {
 	++g_net_global.ifs_size;
 	g_net_global.ifs_arr = realloc(g_net_global.ifs_arr, sizeof(struct net_if_addrs) * g_net_global.ifs_size);
 	struct net_if_addrs *const curr = g_net_global.ifs_arr + (g_net_global.ifs_size - 1);
@@ -81,6 +81,7 @@ unsigned net_add_if(const char *if_name) {
 
 		fdpoll_add(g_net_global.netlink_fd, handle_netlink_read, NULL);
 	}
+	fdpoll_add_owner(g_net_global.netlink_fd, owner);
 
 	int fd = socket(AF_INET, SOCK_DGRAM, 0);
 	if (likely(fd >= 0)) {
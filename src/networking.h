@@ -32,7 +32,12 @@ extern struct net_global_t {
 	int netlink_fd;
 } g_net_global;
 
+struct cmd_data_base;
+
 #define NET_ADD_IF_FAILED ((unsigned)-1)
-unsigned net_add_if(const char *if_name);
+/**
+ * @brief net_add_if watch the interface, and recache @arg owner on its changes
+ */
+unsigned net_add_if(const char *if_name, struct cmd_data_base *owner);
 
 #endif // NETWORKING_H
@@ -0,0 +1,663 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "output.h"
+#include "main.h"
+#include "ini_parser.h"
+#include "json_escape.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+/**
+ * @brief output_slot_reserve make sure the slot of the block can hold @arg len bytes
+ */
+static void output_slot_reserve(struct run_instance *run, size_t len) {
+	if (unlikely(run->out_slot_capacity < len)) {
+		run->out_slot = realloc(run->out_slot, len);
+		run->out_slot_capacity = (unsigned)len;
+	}
+}
+
+static const char *output_block_text(const struct cmd_data_base *data, size_t *len) {
+	*len = data->cached_fulltext ? data->cached_fulltext_len : 0;
+	return data->cached_fulltext ? data->cached_fulltext : "";
+}
+
+/*
+ * i3bar JSON protocol
+ */
+
+static void output_i3bar_prepare(struct run_instance *run) {
+#define PREFIX_NAME ",{\"name\":\""
+#define PREFIX_MARKUP "\",\"markup\":\"none"
+#define PREFIX_INSTANCE "\",\"instance\":\""
+#define PREFIX_FULLTEXT "\",\"full_text\":\""
+	const size_t name_len = strlen(run->vtable->name);
+	const size_t instance_len = run->instance ? strlen(run->instance) : 0;
+	output_slot_reserve(run, X_STRLEN(PREFIX_NAME) + name_len + X_STRLEN(PREFIX_MARKUP) +
+			X_STRLEN(PREFIX_INSTANCE) + JSON_ESCAPE_MAX_LEN(instance_len) + X_STRLEN(PREFIX_FULLTEXT));
+	char *ptr = run->out_slot;
+#define OUTPUT_STR(str, len) memcpy(ptr, (str), (len)); ptr += (len)
+	OUTPUT_STR(PREFIX_NAME, X_STRLEN(PREFIX_NAME));
+	OUTPUT_STR(run->vtable->name, name_len);
+	OUTPUT_STR(PREFIX_MARKUP, X_STRLEN(PREFIX_MARKUP));
+	if (run->instance) {
+		OUTPUT_STR(PREFIX_INSTANCE, X_STRLEN(PREFIX_INSTANCE));
+		ptr += json_escape(ptr, run->instance, instance_len);
+	}
+	OUTPUT_STR(PREFIX_FULLTEXT, X_STRLEN(PREFIX_FULLTEXT));
+#undef OUTPUT_STR
+#undef PREFIX_FULLTEXT
+#undef PREFIX_INSTANCE
+#undef PREFIX_MARKUP
+#undef PREFIX_NAME
+	run->out_prefix_len = (unsigned)(ptr - run->out_slot);
+}
+
+static void output_i3bar_encode(struct run_instance *run, const struct cmd_data_base *data) {
+#define SUFFIX_COLOR "\",\"color\":\""
+	size_t len;
+	const char *text = output_block_text(data, &len);
+	const size_t pos = json_escape_find(text, len);
+	output_slot_reserve(run, run->out_prefix_len + pos + JSON_ESCAPE_MAX_LEN(len - pos) + X_STRLEN(SUFFIX_COLOR) + 7 + 2);
+
+	char *ptr = run->out_slot + run->out_prefix_len;
+	memcpy(ptr, text, pos);
+	ptr += pos;
+	if (unlikely(pos != len))
+		ptr += json_escape(ptr, text + pos, len - pos);
+	if (data->cached_color[0]) {
+		memcpy(ptr, SUFFIX_COLOR, X_STRLEN(SUFFIX_COLOR));
+		memcpy(ptr + X_STRLEN(SUFFIX_COLOR), data->cached_color, 7);
+		ptr += X_STRLEN(SUFFIX_COLOR) + 7;
+	}
+	*(ptr++) = '\"';
+	*(ptr++) = '}';
+	run->out_slot_len = (unsigned)(ptr - run->out_slot);
+#undef SUFFIX_COLOR
+}
+
+/*
+ * plain text, with lemonbar style color escapes
+ */
+
+#define PLAIN_SEPARATOR " | "
+
+static void output_plain_prepare(struct run_instance *run) {
+	output_slot_reserve(run, X_STRLEN(PLAIN_SEPARATOR));
+	memcpy(run->out_slot, PLAIN_SEPARATOR, X_STRLEN(PLAIN_SEPARATOR));
+	run->out_prefix_len = X_STRLEN(PLAIN_SEPARATOR);
+}
+
+static void output_plain_encode(struct run_instance *run, const struct cmd_data_base *data) {
+#define COLOR_START "%{F"
+#define COLOR_END "}"
+#define COLOR_RESET "%{F-}"
+	size_t len;
+	const char *text = output_block_text(data, &len);
+	output_slot_reserve(run, run->out_prefix_len + len * 2 +
+			X_STRLEN(COLOR_START) + 7 + X_STRLEN(COLOR_END) + X_STRLEN(COLOR_RESET));
+
+	char *ptr = run->out_slot + run->out_prefix_len;
+	const bool has_color = data->cached_color[0];
+	if (has_color) {
+		memcpy(ptr, COLOR_START, X_STRLEN(COLOR_START));
+		memcpy(ptr + X_STRLEN(COLOR_START), data->cached_color, 7);
+		memcpy(ptr + X_STRLEN(COLOR_START) + 7, COLOR_END, X_STRLEN(COLOR_END));
+		ptr += X_STRLEN(COLOR_START) + 7 + X_STRLEN(COLOR_END);
+	}
+	for (size_t i = 0; i < len; ++i) {
+		if (unlikely(text[i] == '%')) // escape of lemonbar's format
+			*(ptr++) = '%';
+		*(ptr++) = (text[i] == '\n' ? ' ' : text[i]); // a line is a whole frame
+	}
+	if (has_color) {
+		memcpy(ptr, COLOR_RESET, X_STRLEN(COLOR_RESET));
+		ptr += X_STRLEN(COLOR_RESET);
+	}
+	run->out_slot_len = (unsigned)(ptr - run->out_slot);
+#undef COLOR_RESET
+#undef COLOR_END
+#undef COLOR_START
+}
+
+/*
+ * binary: every block is a record of native uint32_t payload length followed
+ * by payload "name\0instance\0color\0text"; a zero length record ends the frame
+ */
+
+static void output_binary_prepare(struct run_instance *run) {
+	const size_t name_len = strlen(run->vtable->name) + 1;
+	const size_t instance_len = run->instance ? strlen(run->instance) + 1 : 1;
+	output_slot_reserve(run, sizeof(uint32_t) + name_len + instance_len);
+	char *ptr = run->out_slot + sizeof(uint32_t);
+	memcpy(ptr, run->vtable->name, name_len);
+	memcpy(ptr + name_len, run->instance ? run->instance : "", instance_len);
+	run->out_prefix_len = (unsigned)(sizeof(uint32_t) + name_len + instance_len);
+}
+
+static void output_binary_encode(struct run_instance *run, const struct cmd_data_base *data) {
+	size_t len;
+	const char *text = output_block_text(data, &len);
+	output_slot_reserve(run, run->out_prefix_len + 8 + len);
+
+	char *ptr = run->out_slot + run->out_prefix_len;
+	const size_t color_len = data->cached_color[0] ? 8 : 1;
+	memcpy(ptr, data->cached_color, color_len);
+	memcpy(ptr + color_len, text, len);
+	run->out_slot_len = (unsigned)(run->out_prefix_len + color_len + len);
+
+	const uint32_t payload_len = (uint32_t)(run->out_slot_len - sizeof(uint32_t));
+	memcpy(run->out_slot, &payload_len, sizeof(payload_len));
+}
+
+#define OUTPUT_STRINGIFY_(x) #x
+#define OUTPUT_STRINGIFY(x) OUTPUT_STRINGIFY_(x)
+static const struct output_sink g_output_sinks[] = {
+	{
+		.name = "i3bar",
+		.header = "{\"version\":1, \"click_events\": true, \"stop_signal\": " OUTPUT_STRINGIFY(OUTPUT_STOP_SIGNAL)
+			", \"cont_signal\": " OUTPUT_STRINGIFY(OUTPUT_CONT_SIGNAL) "}\n[\n[]\n",
+		.frame_begin = ",[",
+		.frame_end = "]\n",
+		.frame_end_len = 2,
+		.separator_len = 1,
+		.func_prepare = output_i3bar_prepare,
+		.func_encode = output_i3bar_encode,
+	}, {
+		.name = "plain",
+		.header = "",
+		.frame_begin = "",
+		.frame_end = "\n",
+		.frame_end_len = 1,
+		.separator_len = X_STRLEN(PLAIN_SEPARATOR),
+		.func_prepare = output_plain_prepare,
+		.func_encode = output_plain_encode,
+	}, {
+		.name = "binary",
+		.header = "is3-status binary 1\n",
+		.frame_begin = "",
+		.frame_end = "\0\0\0\0",
+		.frame_end_len = sizeof(uint32_t),
+		.separator_len = 0,
+		.func_prepare = output_binary_prepare,
+		.func_encode = output_binary_encode,
+	},
+};
+#undef OUTPUT_STRINGIFY
+#undef OUTPUT_STRINGIFY_
+
+bool output_frame_init(struct output_frame *frame, const char *sink_name) {
+	*frame = (struct output_frame){0};
+	if (sink_name == NULL) {
+		frame->sink = g_output_sinks;
+		return true;
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(g_output_sinks); ++i) {
+		if (0 == strcmp(g_output_sinks[i].name, sink_name)) {
+			frame->sink = g_output_sinks + i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void output_prepare_run(const struct output_frame *frame, struct run_instance *run) {
+	frame->sink->func_prepare(run);
+	run->out_slot_len = run->out_prefix_len;
+	run->data->dirty = true;
+}
+
+void output_frame_update(struct output_frame *frame, struct runs_list *runs) {
+	const struct output_sink *sink = frame->sink;
+	const size_t count = (size_t)(runs->runs_end - runs->runs_begin);
+	if (unlikely(frame->size != count + 2)) {
+		frame->iov = realloc(frame->iov, sizeof(struct iovec) * (count + 2));
+		frame->size = count + 2;
+		frame->iov[0] = (struct iovec){.iov_base = (void *)sink->frame_begin, .iov_len = strlen(sink->frame_begin)};
+		frame->iov[count + 1] = (struct iovec){.iov_base = (void *)sink->frame_end, .iov_len = sink->frame_end_len};
+		FOREACH_RUN(run, runs)
+			(run->placeholder ? run->placeholder : run->data)->dirty = true;
+	}
+
+	struct iovec *slot = frame->iov + 1;
+	FOREACH_RUN(run, runs) {
+		struct cmd_data_base *const shown = run->placeholder ? run->placeholder : run->data;
+		if (shown->dirty && likely(shown != run->data || !run->busy)) { // a worker might be writing into busy data
+			shown->dirty = false;
+			sink->func_encode(run, shown);
+			const size_t skip = (run == runs->runs_begin ? sink->separator_len : 0); // separator before all except first
+			*slot = (struct iovec){.iov_base = run->out_slot + skip, .iov_len = run->out_slot_len - skip};
+		}
+		++slot;
+	}
+}
+
+void output_frame_select(struct output_frame *frame, struct run_instance *const *blocks, size_t count) {
+	const struct output_sink *sink = frame->sink;
+	if (unlikely(frame->size != count + 2)) {
+		frame->iov = realloc(frame->iov, sizeof(struct iovec) * (count + 2));
+		frame->size = count + 2;
+		frame->iov[0] = (struct iovec){.iov_base = (void *)sink->frame_begin, .iov_len = strlen(sink->frame_begin)};
+		frame->iov[count + 1] = (struct iovec){.iov_base = (void *)sink->frame_end, .iov_len = sink->frame_end_len};
+	}
+	for (size_t i = 0; i < count; ++i) {
+		const size_t skip = (i == 0 ? sink->separator_len : 0);
+		frame->iov[i + 1] = (struct iovec){.iov_base = blocks[i]->out_slot + skip, .iov_len = blocks[i]->out_slot_len - skip};
+	}
+}
+
+/**
+ * @brief output_frame_backlog copy the unsent remainder of the frame into the backlog
+ */
+static void output_frame_backlog(struct output_frame *frame, const struct iovec *iov, size_t count, size_t offset) {
+	size_t len = 0;
+	for (size_t i = 0; i < count; ++i)
+		len += iov[i].iov_len;
+	len -= offset;
+	if (frame->backlog_capacity < len) {
+		frame->backlog = realloc(frame->backlog, len);
+		frame->backlog_capacity = len;
+	}
+	char *ptr = frame->backlog;
+	for (size_t i = 0; i < count; ++i, offset = 0) {
+		memcpy(ptr, (const char *)iov[i].iov_base + offset, iov[i].iov_len - offset);
+		ptr += iov[i].iov_len - offset;
+	}
+	frame->backlog_pos = 0;
+	frame->backlog_len = len;
+}
+
+static bool output_frame_writev(struct output_frame *frame, int fd) {
+	const struct iovec *iov = frame->iov;
+	size_t count = frame->size;
+	++g_stats.frames_sent;
+	while (count > 0) {
+		ssize_t len = writev(fd, iov, (int)(count < IOV_MAX ? count : IOV_MAX));
+		if (unlikely(len < 0)) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return false;
+			output_frame_backlog(frame, iov, count, 0);
+			return true;
+		}
+		for (; count > 0 && (size_t)len >= iov->iov_len; ++iov, --count)
+			len -= (ssize_t)iov->iov_len;
+		if (len > 0) { // short write inside a slot, the table itself isn't modified
+			output_frame_backlog(frame, iov, count, (size_t)len);
+			return output_frame_flush(frame, fd);
+		}
+	}
+	return true;
+}
+
+bool output_frame_send(struct output_frame *frame, int fd) {
+	if (unlikely(output_frame_busy(frame))) {
+		if (frame->queued)
+			++g_stats.frames_dropped;
+		frame->queued = true; // the slots always hold the latest frame
+		return true;
+	}
+	return output_frame_writev(frame, fd);
+}
+
+bool output_frame_send_header(struct output_frame *frame, int fd) {
+	const struct iovec header = {.iov_base = (void *)frame->sink->header, .iov_len = strlen(frame->sink->header)};
+	output_frame_backlog(frame, &header, 1, 0);
+	frame->queued = true;
+	return output_frame_flush(frame, fd);
+}
+
+bool output_frame_flush(struct output_frame *frame, int fd) {
+	while (frame->backlog_pos < frame->backlog_len) {
+		const ssize_t res = write(fd, frame->backlog + frame->backlog_pos, frame->backlog_len - frame->backlog_pos);
+		if (unlikely(res < 0)) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+			frame->backlog_pos = frame->backlog_len = 0;
+			frame->queued = false;
+			return false;
+		}
+		frame->backlog_pos += (size_t)res;
+	}
+	frame->backlog_pos = frame->backlog_len = 0;
+	if (frame->queued) {
+		frame->queued = false;
+		return output_frame_writev(frame, fd);
+	}
+	return true;
+}
+
+void output_frame_free(struct output_frame *frame) {
+	free(frame->iov);
+	free(frame->backlog);
+	*frame = (struct output_frame){0};
+}
+
+#ifdef TESTS
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <yajl/yajl_parse.h>
+
+struct test_output_ctx {
+	const struct cmd_data_base *datas;
+	unsigned maps;
+	unsigned texts;
+	bool is_fulltext;
+	bool bad_text;
+};
+
+/// texts are generated as repeating of the block index letter, with a quote in some
+static void test_output_fill(struct cmd_data_base *data, unsigned idx, size_t len) {
+	data->cached_fulltext = realloc(data->cached_fulltext, len + 1);
+	memset(data->cached_fulltext, 'a' + idx % 26, len);
+	if (idx % 5 == 0 && len > 0)
+		data->cached_fulltext[len / 2] = '"'; // must be escaped
+	data->cached_fulltext[len] = '\0';
+	data->cached_fulltext_len = (unsigned)len;
+	data->dirty = true;
+}
+
+static int test_output_map_key(void *_ctx, const unsigned char *str, size_t len) {
+	struct test_output_ctx *ctx = _ctx;
+	ctx->is_fulltext = (len == 9 && 0 == memcmp(str, "full_text", 9));
+	return true;
+}
+
+static int test_output_string(void *_ctx, const unsigned char *str, size_t len) {
+	struct test_output_ctx *ctx = _ctx;
+	if (ctx->is_fulltext) {
+		const struct cmd_data_base *data = ctx->datas + ctx->texts;
+		if (len != data->cached_fulltext_len || 0 != memcmp(str, data->cached_fulltext, len))
+			ctx->bad_text = true;
+		ctx->texts++;
+	}
+	return true;
+}
+
+static int test_output_start_map(void *_ctx) {
+	((struct test_output_ctx *)_ctx)->maps++;
+	return true;
+}
+
+/// read all of @arg fd content into a malloc-ed buffer
+static char *test_output_read_all(int fd, size_t *len) {
+	const off_t size = lseek(fd, 0, SEEK_END);
+	char *buf = malloc((size_t)size);
+	*len = (size_t)pread(fd, buf, (size_t)size, 0);
+	return buf;
+}
+
+static bool test_output_backpressure(struct output_frame *frame, struct runs_list *runs, int memfd) {
+#define TEST_ERR(...) ((void)fprintf(stderr, __VA_ARGS__), false)
+#define ERR_STR(str) "test_output_backpressure: "str"\n"
+	int pipefd[2];
+	if (0 != pipe2(pipefd, O_NONBLOCK | O_CLOEXEC))
+		return TEST_ERR(ERR_STR("pipe failed"));
+	fcntl(pipefd[1], F_SETPIPE_SZ, 4096);
+
+	// expected output: the frame in flight, followed by the latest frame
+	size_t first_len, last_len, got_len = 0;
+	ftruncate(memfd, 0);
+	lseek(memfd, 0, SEEK_SET);
+	output_frame_send(frame, memfd);
+	char *first = test_output_read_all(memfd, &first_len);
+
+	bool res = true;
+	const unsigned long dropped = g_stats.frames_dropped;
+	if (!output_frame_send(frame, pipefd[1]) || !output_frame_busy(frame))
+		res = TEST_ERR(ERR_STR("frame should be in flight"));
+	for (unsigned round = 0; round < 3; ++round) {
+		FOREACH_RUN(run, runs)
+			test_output_fill(run->data, round, run->data->cached_fulltext_len / 2 + round);
+		output_frame_update(frame, runs);
+		output_frame_send(frame, pipefd[1]);
+	}
+	if (g_stats.frames_dropped - dropped != 2)
+		res = TEST_ERR(ERR_STR("expected 2 dropped frames, got %lu"), g_stats.frames_dropped - dropped);
+
+	char *got = malloc(first_len * 2 + 65536);
+	for (ssize_t len = 1; res && (len > 0 || output_frame_busy(frame)); ) {
+		if (!output_frame_flush(frame, pipefd[1]))
+			res = TEST_ERR(ERR_STR("flush failed"));
+		if (0 < (len = read(pipefd[0], got + got_len, 65536)))
+			got_len += (size_t)len;
+	}
+
+	ftruncate(memfd, 0);
+	lseek(memfd, 0, SEEK_SET);
+	output_frame_send(frame, memfd);
+	char *last = test_output_read_all(memfd, &last_len);
+	if (res && (got_len != first_len + last_len || 0 != memcmp(got, first, first_len) ||
+			0 != memcmp(got + first_len, last, last_len)))
+		res = TEST_ERR(ERR_STR("output isn't the in flight frame followed by the latest frame"));
+
+	free(got);
+	free(first);
+	free(last);
+	close(pipefd[0]);
+	close(pipefd[1]);
+	return res;
+#undef ERR_STR
+#undef TEST_ERR
+}
+
+static bool test_output_sink(const char *sink_name, struct runs_list *runs, const char *expected, size_t expected_len) {
+	struct output_frame frame;
+	if (!output_frame_init(&frame, sink_name)) {
+		fprintf(stderr, "test_output_sinks: sink %s not found\n", sink_name);
+		return false;
+	}
+	FOREACH_RUN(run, runs)
+		output_prepare_run(&frame, run);
+	output_frame_update(&frame, runs);
+
+	const int fd = memfd_create("test_output_sinks", MFD_CLOEXEC);
+	output_frame_send(&frame, fd);
+	size_t len;
+	char *buf = test_output_read_all(fd, &len);
+	const bool res = (len == expected_len && 0 == memcmp(buf, expected, len));
+	if (!res)
+		fprintf(stderr, "test_output_sinks: sink %s output is incorrect\n", sink_name);
+	free(buf);
+	close(fd);
+	output_frame_free(&frame);
+	FOREACH_RUN(run, runs) {
+		free(run->out_slot);
+		run->out_slot = NULL;
+		run->out_slot_capacity = 0;
+	}
+	return res;
+}
+
+static bool test_output_sinks(void) {
+	static const struct cmd test_cmds[] = { { .name = "date" }, { .name = "eth" }, { .name = "x" } };
+	struct cmd_data_base datas[3] = {
+		{ .cached_fulltext = "12:00", .cached_fulltext_len = 5 },
+		{ .cached_fulltext = "50% up\n", .cached_fulltext_len = 7, .cached_color = "#00FF00" },
+		{ .cached_fulltext = NULL },
+	};
+	struct run_instance runs_arr[3] = {
+		{ .vtable = test_cmds + 0, .data = datas + 0 },
+		{ .vtable = test_cmds + 1, .data = datas + 1, .instance = "wlan0" },
+		{ .vtable = test_cmds + 2, .data = datas + 2 },
+	};
+	struct runs_list runs = {runs_arr, runs_arr + 3};
+
+	static const char plain[] = "12:00 | %{F#00FF00}50%% up %{F-} | \n";
+	if (!test_output_sink("plain", &runs, plain, X_STRLEN(plain)))
+		return false;
+
+	char binary[128], *ptr = binary;
+#define APPEND_RECORD(str) do { \
+		const uint32_t len = sizeof(str) - 1; \
+		memcpy(ptr, &len, sizeof(len)); \
+		memcpy(ptr + sizeof(len), str, len); \
+		ptr += sizeof(len) + len; \
+	} while (0)
+	APPEND_RECORD("date\0\0\0" "12:00");
+	APPEND_RECORD("eth\0wlan0\0#00FF00\0" "50% up\n");
+	APPEND_RECORD("x\0\0\0");
+	APPEND_RECORD("");
+#undef APPEND_RECORD
+	return test_output_sink("binary", &runs, binary, (size_t)(ptr - binary));
+}
+
+static bool test_output_header(struct output_frame *frame, int memfd) {
+#define TEST_ERR(...) ((void)fprintf(stderr, __VA_ARGS__), false)
+#define ERR_STR(str) "test_output_header: "str"\n"
+	int pipefd[2];
+	if (0 != pipe2(pipefd, O_NONBLOCK | O_CLOEXEC))
+		return TEST_ERR(ERR_STR("pipe failed"));
+	fcntl(pipefd[1], F_SETPIPE_SZ, 4096);
+
+	// expected output: the header followed by the frame, even when the header itself can't be written yet
+	size_t frame_len, got_len = 0, filler_len = 0;
+	ftruncate(memfd, 0);
+	lseek(memfd, 0, SEEK_SET);
+	output_frame_send(frame, memfd);
+	char *expected = test_output_read_all(memfd, &frame_len);
+	const size_t header_len = strlen(frame->sink->header);
+
+	char filler[512];
+	memset(filler, 'x', sizeof(filler));
+	for (ssize_t len; 0 < (len = write(pipefd[1], filler, sizeof(filler))); )
+		filler_len += (size_t)len;
+
+	bool res = true;
+	if (!output_frame_send_header(frame, pipefd[1]) || !output_frame_busy(frame))
+		res = TEST_ERR(ERR_STR("header should wait for the pipe"));
+	char *got = malloc(filler_len + header_len + frame_len + 65536);
+	for (ssize_t len = 1; res && (len > 0 || output_frame_busy(frame)); ) {
+		if (0 < (len = read(pipefd[0], got + got_len, 65536)))
+			got_len += (size_t)len;
+		if (!output_frame_flush(frame, pipefd[1]))
+			res = TEST_ERR(ERR_STR("flush failed"));
+	}
+	if (res && (got_len != filler_len + header_len + frame_len ||
+			0 != memcmp(got + filler_len, frame->sink->header, header_len) ||
+			0 != memcmp(got + filler_len + header_len, expected, frame_len)))
+		res = TEST_ERR(ERR_STR("output isn't the header followed by the frame"));
+
+	free(got);
+	free(expected);
+	close(pipefd[0]);
+	close(pipefd[1]);
+	return res;
+#undef ERR_STR
+#undef TEST_ERR
+}
+
+int test_output_frame(void) {
+#define TEST_ERR(...) ((void)fprintf(stderr, __VA_ARGS__), false)
+#define ERR_STR(str) "test_output_frame: "str"\n"
+	enum { BLOCKS = 600, TEXT_MAX = 8192, ROUNDS = 3 };
+	static const struct cmd test_cmd = { .name = "stress" };
+
+	struct run_instance *runs_arr = calloc(BLOCKS, sizeof(struct run_instance));
+	struct cmd_data_base *datas = calloc(BLOCKS, sizeof(struct cmd_data_base));
+	struct runs_list runs = {runs_arr, runs_arr + BLOCKS};
+	for (unsigned i = 0; i < BLOCKS; ++i) {
+		test_output_fill(datas + i, i, (i * 977) % TEXT_MAX);
+		if (i % 3 == 0)
+			memcpy(datas[i].cached_color, "#00FF00", 8);
+		runs_arr[i].vtable = &test_cmd;
+		runs_arr[i].data = datas + i;
+		if (i % 2 == 0) {
+			runs_arr[i].instance = malloc(16);
+			snprintf(runs_arr[i].instance, 16, "inst%u", i);
+		}
+	}
+	struct output_frame frame;
+	output_frame_init(&frame, NULL);
+	FOREACH_RUN(run, &runs)
+		output_prepare_run(&frame, run);
+
+	bool res = true;
+	const int fd = memfd_create("test_output_frame", MFD_CLOEXEC);
+	for (unsigned round = 0; res && round < ROUNDS; ++round) {
+		if (round != 0) { // change some of the blocks, including growing past their slot's capacity
+			for (unsigned i = round; i < BLOCKS; i += 7)
+				test_output_fill(datas + i, i, (datas[i].cached_fulltext_len * 3 + round) % (TEXT_MAX * 2));
+		}
+		const struct iovec *prev_iov = frame.iov;
+		output_frame_update(&frame, &runs);
+		if (round != 0 && prev_iov != frame.iov)
+			res = TEST_ERR(ERR_STR("frame reallocated after warm up"));
+
+		ftruncate(fd, 0);
+		lseek(fd, 0, SEEK_SET);
+		if (!output_frame_send(&frame, fd)) {
+			res = TEST_ERR(ERR_STR("write failed: %s"), strerror(errno));
+			break;
+		}
+		const off_t size = lseek(fd, 0, SEEK_CUR);
+		char *buf = malloc((size_t)size);
+		if (size != pread(fd, buf, (size_t)size, 0))
+			res = TEST_ERR(ERR_STR("read back failed"));
+		else if (buf[0] != ',' || buf[size - 2] != ']' || buf[size - 1] != '\n')
+			res = TEST_ERR(ERR_STR("frame isn't complete"));
+		else {
+			static const yajl_callbacks callbacks = {
+				.yajl_string = test_output_string,
+				.yajl_map_key = test_output_map_key,
+				.yajl_start_map = test_output_start_map,
+			};
+			struct test_output_ctx ctx = {datas, 0, 0, false, false};
+			yajl_handle handle = yajl_alloc(&callbacks, NULL, &ctx);
+			if (yajl_status_ok != yajl_parse(handle, (const unsigned char *)buf + 1, (size_t)size - 2) ||
+					yajl_status_ok != yajl_complete_parse(handle))
+				res = TEST_ERR(ERR_STR("frame isn't valid JSON"));
+			else if (ctx.maps != BLOCKS || ctx.texts != BLOCKS)
+				res = TEST_ERR(ERR_STR("expected %u blocks, found %u"), BLOCKS, ctx.texts);
+			else if (ctx.bad_text)
+				res = TEST_ERR(ERR_STR("block text is corrupted in round %u"), round);
+			yajl_free(handle);
+		}
+		free(buf);
+	}
+
+	if (res) // slow reader: the in flight frame is completed, and only the latest queued frame is sent after it
+		res = test_output_backpressure(&frame, &runs, fd);
+	if (res)
+		res = test_output_header(&frame, fd);
+	close(fd);
+
+	output_frame_free(&frame);
+	for (unsigned i = 0; i < BLOCKS; ++i) {
+		free(datas[i].cached_fulltext);
+		free(runs_arr[i].instance);
+		free(runs_arr[i].out_slot);
+	}
+	free(datas);
+	free(runs_arr);
+	return res && test_output_sinks();
+#undef ERR_STR
+#undef TEST_ERR
+}
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/uio.h>
+
+#include <signal.h>
+
+/**
+ * @brief signals the bar sends when it's hidden and shown again, declared in i3bar's header
+ */
+#define OUTPUT_STOP_SIGNAL SIGUSR2
+#define OUTPUT_CONT_SIGNAL SIGCONT
+
+struct cmd_data_base;
+struct run_instance;
+struct runs_list;
+
+/**
+ * @brief output format of the frames
+ *
+ * Every block's slot starts with a constant prefix, rendered once by
+ * func_prepare, followed by its text and color, re-encoded by func_encode.
+ */
+struct output_sink {
+	const char *name; ///< name used in the general `output` option
+	const char *header; ///< sent once, before the first frame
+	const char *frame_begin;
+	const char *frame_end;
+	unsigned frame_end_len; ///< frame_end may contain zero bytes
+	unsigned separator_len; ///< length of prefix skipped for the first block
+	void (*func_prepare)(struct run_instance *run);
+	void (*func_encode)(struct run_instance *run, const struct cmd_data_base *data);
+};
+
+/**
+ * @brief persistent output frame, sent using writev
+ *
+ * Every block owns a slot (its serialized JSON object), which is re-encoded
+ * only when the block is dirty, so updating the frame costs per changed block.
+ * Slots keep their capacity between frames, so once warmed up, updating the
+ * frame doesn't allocate.
+ *
+ * The frame is sent without blocking. When the reader is slow, the unsent
+ * remainder is copied into the backlog, and while it drains only the latest
+ * frame is kept queued.
+ */
+struct output_frame {
+	const struct output_sink *sink;
+	struct iovec *iov; ///< frame start, the slot of every block, frame end
+	size_t size;
+
+	char *backlog; ///< unsent remainder of a partially written frame
+	size_t backlog_pos;
+	size_t backlog_len;
+	size_t backlog_capacity;
+	bool queued; ///< a newer frame waits for the backlog to drain
+};
+
+/**
+ * @brief output_frame_init initialize an empty frame for the requested sink
+ *
+ * @param sink_name name of the output sink, NULL for i3bar
+ * @return false if no sink exists with such name
+ */
+bool output_frame_init(struct output_frame *frame, const char *sink_name);
+/**
+ * @brief output_prepare_run render the constant parts of the block
+ *
+ * Must be called once, after the config was loaded
+ */
+void output_prepare_run(const struct output_frame *frame, struct run_instance *run);
+/**
+ * @brief output_frame_update re-encode the slots of all dirty blocks
+ *
+ * A block with a placeholder set is encoded from it instead of its data.
+ */
+void output_frame_update(struct output_frame *frame, struct runs_list *runs);
+/**
+ * @brief output_frame_select point the frame at the slots of a subset of the blocks
+ *
+ * The slots aren't encoded, so they must be already updated by
+ * output_frame_update of a frame holding all the blocks.
+ */
+void output_frame_select(struct output_frame *frame, struct run_instance *const *blocks, size_t count);
+/**
+ * @brief output_frame_send send the frame into non-blocking @arg fd
+ *
+ * If the previous frame wasn't fully written yet, the frame is queued instead,
+ * replacing (and dropping) the frame queued before it.
+ *
+ * @return false on write failure
+ */
+bool output_frame_send(struct output_frame *frame, int fd);
+/**
+ * @brief output_frame_send_header send the sink's header into non-blocking @arg fd, followed by the frame
+ *
+ * Must be called before anything else was sent into @arg fd.
+ *
+ * @return false on write failure
+ */
+bool output_frame_send_header(struct output_frame *frame, int fd);
+/**
+ * @brief output_frame_flush continue sending the backlog and the queued frame
+ *
+ * Should be called when @arg fd is writable again.
+ *
+ * @return false on write failure
+ */
+bool output_frame_flush(struct output_frame *frame, int fd);
+static inline bool output_frame_busy(const struct output_frame *frame) {
+	return frame->backlog_len != 0;
+}
+void output_frame_free(struct output_frame *frame);
+
+#ifdef TESTS
+int test_output_frame(void);
+#endif
+
+#endif // OUTPUT_H
@@ -0,0 +1,146 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "parallel_init.h"
+#include "main.h"
+#include "ini_parser.h"
+#include "fdpoll.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define PARALLEL_INIT_TEXT "…" ///< default placeholder
+
+struct init_job {
+	struct run_instance *run;
+	pthread_t thread;
+	struct fdpoll_deferred deferred;
+	struct cmd_data_base placeholder; ///< shown while the init runs
+	atomic_bool done;
+	bool success;
+	bool thread_started;
+	bool finished; ///< handled by the main thread
+};
+
+static struct {
+	struct init_job *jobs;
+	unsigned jobs_count;
+	unsigned pending;
+	int done_fd; ///< eventfd signaled by threads when their init is done
+	void (*func_ready)(struct run_instance *run, bool success, void *arg);
+	void *arg;
+} g_parallel_init = {.jobs = NULL, .jobs_count = 0, .pending = 0, .done_fd = -1, .func_ready = NULL, .arg = NULL};
+
+static void *init_job_run(void *arg) {
+	struct init_job *job = arg;
+	fdpoll_defer_begin(&job->deferred);
+	job->success = job->run->vtable->func_init_deferred(job->run->data);
+	fdpoll_defer_end();
+	atomic_store_explicit(&job->done, true, memory_order_release);
+	const uint64_t one = 1;
+	if (unlikely(sizeof(one) != write(g_parallel_init.done_fd, &one, sizeof(one))))
+		fprintf(stderr, "parallel_init: unable to signal done: %s\n", strerror(errno));
+	return NULL;
+}
+
+static bool parallel_init_handle_done(void *arg) {
+	(void)arg;
+	uint64_t count;
+	if (unlikely(0 > read(g_parallel_init.done_fd, &count, sizeof(count))))
+		return false;
+	for (unsigned i = 0; i < g_parallel_init.jobs_count; i++) {
+		struct init_job *const job = g_parallel_init.jobs + i;
+		if (job->finished || !atomic_load_explicit(&job->done, memory_order_acquire))
+			continue;
+		if (job->thread_started)
+			pthread_join(job->thread, NULL);
+		job->finished = true;
+		g_parallel_init.pending--;
+		fdpoll_deferred_apply(&job->deferred);
+		struct run_instance *const run = job->run;
+		run->starting = false;
+		run->busy = false;
+		run->placeholder = NULL;
+		run->data->dirty = true;
+		g_parallel_init.func_ready(run, job->success, g_parallel_init.arg);
+	}
+	if (g_parallel_init.pending == 0) {
+		fdpoll_remove(g_parallel_init.done_fd);
+		close(g_parallel_init.done_fd);
+		g_parallel_init.done_fd = -1;
+	}
+	return false;
+}
+
+bool parallel_init_start(struct runs_list *runs, void (*func_ready)(struct run_instance *run, bool success, void *arg), void *arg) {
+	FOREACH_RUN(run, runs)
+		if (run->vtable->func_init_deferred)
+			g_parallel_init.jobs_count++;
+	if (g_parallel_init.jobs_count == 0)
+		return true;
+	if (unlikely(0 > (g_parallel_init.done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)))) {
+		fprintf(stderr, "parallel_init: eventfd failed: %s\n", strerror(errno));
+		return false;
+	}
+	g_parallel_init.jobs = calloc(g_parallel_init.jobs_count, sizeof(struct init_job));
+	g_parallel_init.pending = g_parallel_init.jobs_count;
+	g_parallel_init.func_ready = func_ready;
+	g_parallel_init.arg = arg;
+
+	char *const text = g_general_settings.placeholder ? g_general_settings.placeholder : PARALLEL_INIT_TEXT;
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old); // signals are handled only by the main thread
+	struct init_job *job = g_parallel_init.jobs;
+	FOREACH_RUN(run, runs) {
+		if (!run->vtable->func_init_deferred)
+			continue;
+		job->run = run;
+		atomic_init(&job->done, false);
+		job->placeholder.cached_fulltext = text;
+		job->placeholder.cached_fulltext_len = (unsigned)strlen(text);
+		job->placeholder.dirty = true;
+		run->placeholder = &job->placeholder;
+		run->starting = true;
+		run->busy = true;
+		if (likely(0 == pthread_create(&job->thread, NULL, init_job_run, job)))
+			job->thread_started = true;
+		else
+			init_job_run(job); // init inline instead, still reported through done_fd
+		job++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	fdpoll_add(g_parallel_init.done_fd, parallel_init_handle_done, NULL);
+	return true;
+}
+
+void parallel_init_free(void) {
+	if (g_parallel_init.pending > 0) // a stuck init still uses its job
+		return;
+	free(g_parallel_init.jobs);
+	g_parallel_init.jobs = NULL;
+	g_parallel_init.jobs_count = 0;
+}
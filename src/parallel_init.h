@@ -0,0 +1,41 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PARALLEL_INIT_H
+#define PARALLEL_INIT_H
+
+#include <stdbool.h>
+
+struct run_instance;
+struct runs_list;
+
+/**
+ * @brief parallel_init_start run func_init_deferred of the blocks which have it, each on its own thread
+ *
+ * Until its deferred init is done, a block is marked starting and busy, and
+ * shows the placeholder. Its fdpoll calls are recorded and applied once it is
+ * done. Then @arg func_ready is called on the main thread, as part of fdpoll_run.
+ *
+ * @return false if no thread could be started
+ */
+bool parallel_init_start(struct runs_list *runs, void (*func_ready)(struct run_instance *run, bool success, void *arg), void *arg);
+/**
+ * @brief parallel_init_free release the finished inits, inits still running are left alone
+ */
+void parallel_init_free(void);
+
+#endif // PARALLEL_INIT_H
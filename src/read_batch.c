@@ -0,0 +1,207 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "read_batch.h"
+#include "main.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <liburing.h>
+
+#define READ_BATCH_DEPTH 32
+
+static struct {
+	struct io_uring ring;
+	bool initialized;
+	bool failed; ///< ring setup failed, stay with synchronous reads
+} g_read_batch = {.initialized = false, .failed = false};
+
+static bool read_batch_ring(void) {
+	if (likely(g_read_batch.initialized))
+		return true;
+	if (g_read_batch.failed)
+		return false;
+	int ret = io_uring_queue_init(READ_BATCH_DEPTH, &g_read_batch.ring, 0);
+	if (unlikely(ret < 0)) {
+		fprintf(stderr, "read_batch: io_uring unavailable (%s), using synchronous reads\n", strerror(-ret));
+		g_read_batch.failed = true;
+		return false;
+	}
+	g_read_batch.initialized = true;
+	return true;
+}
+
+/**
+ * @brief read_batch_disable tear down the ring for good, and stay with synchronous reads
+ *
+ * Entries left in the submission queue are dropped with the ring, so they
+ * never complete into a read_batch that was meanwhile read synchronously.
+ */
+static void read_batch_disable(void) {
+	io_uring_queue_exit(&g_read_batch.ring);
+	g_read_batch.initialized = false;
+	g_read_batch.failed = true;
+}
+
+/**
+ * @brief read_batch_reap collect the completions of a submission of @arg queued entries
+ *
+ * @return false if the ring was torn down, as the submission was short or failed
+ */
+static bool read_batch_reap(struct io_uring *ring, unsigned queued, int submitted) {
+	if (unlikely(submitted < 0)) {
+		fprintf(stderr, "read_batch: submit failed with %s, using synchronous reads\n", strerror(-submitted));
+		read_batch_disable();
+		return false;
+	}
+	for (int i = 0; i < submitted; i++) {
+		struct io_uring_cqe *cqe;
+		if (unlikely(io_uring_wait_cqe(ring, &cqe) < 0)) {
+			read_batch_disable();
+			return false;
+		}
+		struct read_batch *rb = (struct read_batch *)io_uring_cqe_get_data(cqe);
+		rb->result = cqe->res;
+		rb->ready = true;
+		io_uring_cqe_seen(ring, cqe);
+	}
+	if (unlikely((unsigned)submitted < queued)) {
+		fprintf(stderr, "read_batch: short submit (%d of %u), using synchronous reads\n", submitted, queued);
+		read_batch_disable();
+		return false;
+	}
+	return true;
+}
+#endif
+
+ssize_t read_batch_read(struct read_batch *rb) {
+	if (rb->ready) {
+		rb->ready = false;
+		if (unlikely(rb->result < 0)) {
+			errno = -rb->result;
+			return -1;
+		}
+		return rb->result;
+	}
+	return pread(rb->fd, rb->buf, rb->size, 0);
+}
+
+void read_batch_prefetch(struct read_batch *const *rbs, unsigned count) {
+#ifdef HAVE_IO_URING
+	if (count < 2 || !read_batch_ring()) // a single read gains nothing from the ring
+		return;
+	struct io_uring *const ring = &g_read_batch.ring;
+	while (count > 0) {
+		unsigned queued = 0;
+		for (; queued < count && queued < READ_BATCH_DEPTH; queued++) {
+			struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+			if (unlikely(!sqe))
+				break;
+			io_uring_prep_read(sqe, rbs[queued]->fd, rbs[queued]->buf, rbs[queued]->size, 0);
+			io_uring_sqe_set_data(sqe, rbs[queued]);
+		}
+		if (unlikely(queued == 0))
+			return;
+		// the kernel doesn't wait when it submitted less than queued
+		if (!read_batch_reap(ring, queued, io_uring_submit_and_wait(ring, queued)))
+			return; // not ready entries are read synchronously
+		rbs += queued;
+		count -= queued;
+	}
+#else
+	(void)rbs;
+	(void)count;
+#endif
+}
+
+void read_batch_free(void) {
+#ifdef HAVE_IO_URING
+	if (g_read_batch.initialized)
+		io_uring_queue_exit(&g_read_batch.ring);
+	g_read_batch.initialized = false;
+#endif
+}
+
+#ifdef TESTS
+
+#include <sys/mman.h>
+
+static bool test_read_batch_content(struct read_batch *rb, const char *expected) {
+	return 4 == read_batch_read(rb) && 0 == memcmp(rb->buf, expected, 4) && !rb->ready;
+}
+
+int test_read_batch(void) {
+#define TEST_ERR(...) ((void)fprintf(stderr, __VA_ARGS__), false)
+#define ERR_STR(str) "test_read_batch: "str"\n"
+	char bufs[3][8];
+	struct read_batch rbs[3];
+	struct read_batch *const rbs_ptr[3] = {rbs + 0, rbs + 1, rbs + 2};
+	const int fd = memfd_create("test_read_batch", MFD_CLOEXEC);
+	if (fd < 0 || 4 != pwrite(fd, "old\n", 4, 0))
+		return TEST_ERR(ERR_STR("memfd setup failed"));
+	for (unsigned i = 0; i < ARRAY_SIZE(rbs); i++)
+		read_batch_init(rbs + i, fd, bufs[i], sizeof(bufs[i]));
+
+	bool res = true;
+	read_batch_prefetch(rbs_ptr, 2);
+	if (rbs[2].ready)
+		res = TEST_ERR(ERR_STR("entry not passed was prefetched"));
+	else if (!test_read_batch_content(rbs + 0, "old\n") || !test_read_batch_content(rbs + 1, "old\n"))
+		res = TEST_ERR(ERR_STR("wrong prefetched content"));
+#ifdef HAVE_IO_URING
+	else if (read_batch_ring()) { // short submit: of 2 queued entries, only the first reaches the kernel
+		struct io_uring *const ring = &g_read_batch.ring;
+		struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+		io_uring_prep_read(sqe, fd, bufs[0], sizeof(bufs[0]), 0);
+		io_uring_sqe_set_data(sqe, rbs + 0);
+		const int submitted = io_uring_submit(ring);
+		sqe = io_uring_get_sqe(ring);
+		io_uring_prep_read(sqe, fd, bufs[1], sizeof(bufs[1]), 0);
+		io_uring_sqe_set_data(sqe, rbs + 1);
+		if (read_batch_reap(ring, 2, submitted))
+			res = TEST_ERR(ERR_STR("short submit isn't detected"));
+		else if (!rbs[0].ready || rbs[1].ready)
+			res = TEST_ERR(ERR_STR("wrong entries completed on short submit"));
+		else if (!g_read_batch.failed || g_read_batch.initialized)
+			res = TEST_ERR(ERR_STR("ring isn't torn down on short submit"));
+		rbs[0].ready = false;
+	}
+#endif
+
+	// after a fallback, the dropped entry must never complete over a synchronous read
+	if (res && 4 == pwrite(fd, "new\n", 4, 0)) {
+		read_batch_prefetch(rbs_ptr, 3);
+		for (unsigned i = 0; res && i < ARRAY_SIZE(rbs); i++)
+			if (!test_read_batch_content(rbs + i, "new\n"))
+				res = TEST_ERR(ERR_STR("stale content in entry %u"), i);
+	}
+	close(fd);
+	read_batch_free();
+#ifdef HAVE_IO_URING
+	g_read_batch.failed = false;
+#endif
+	return res;
+#undef ERR_STR
+#undef TEST_ERR
+}
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef READ_BATCH_H
+#define READ_BATCH_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * @brief a whole-file read of a sysfs/procfs source, which can be prefetched
+ *
+ * A module registers it in func_init using cmd_data_base::read_batch, and
+ * reads it in func_recache using read_batch_read(). When io_uring is
+ * available, the reads of all due blocks are submitted together before
+ * their recache, otherwise read_batch_read() reads synchronously.
+ */
+struct read_batch {
+	int fd;
+	unsigned size; ///< maximal bytes to read into buf
+	char *buf;
+	int result; ///< bytes read or negative errno, valid only when ready
+	bool ready; ///< buf already holds the prefetched content
+};
+
+static inline void read_batch_init(struct read_batch *rb, int fd, char *buf, unsigned size) {
+	rb->fd = fd;
+	rb->size = size;
+	rb->buf = buf;
+	rb->result = 0;
+	rb->ready = false;
+}
+
+/**
+ * @brief read_batch_read read the file from its start into rb->buf
+ *
+ * Uses the prefetched content if available, otherwise reads synchronously.
+ *
+ * @return bytes read, or -1 on failure with errno set
+ */
+ssize_t read_batch_read(struct read_batch *rb);
+/**
+ * @brief read_batch_prefetch read all @arg rbs using a single io_uring submission
+ *
+ * Does nothing when built without io_uring, or when the ring can't be
+ * created, or once a submission fails or is short, so read_batch_read()
+ * falls back to synchronous reads.
+ */
+void read_batch_prefetch(struct read_batch *const *rbs, unsigned count);
+void read_batch_free(void);
+
+#ifdef TESTS
+int test_read_batch(void);
+#endif
+
+#endif // READ_BATCH_H
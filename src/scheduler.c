@@ -0,0 +1,134 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "scheduler.h"
+#include "main.h"
+#include "ini_parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <time.h>
+
+long monotonic_ms(void) {
+#ifdef PROFILE
+	// virtual clock advancing a second on every read, so the profiling loop recaches without waiting
+	static long now = 0;
+	return now += 1000;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+long scheduler_align_second(long deadline) {
+#ifdef PROFILE
+	return deadline;
+#else
+	struct timespec mono, wall;
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &wall);
+	const long long wall_offset = (long long)(wall.tv_sec - mono.tv_sec) * 1000000000LL + (wall.tv_nsec - mono.tv_nsec);
+	long long rem = ((long long)deadline * 1000000LL + wall_offset) % 1000000000LL;
+	if (rem < 0)
+		rem += 1000000000LL;
+	// to the nearest boundary, so jitter between the two clocks never moves a whole second;
+	// rounded so the deadline is never before the boundary
+	if (rem >= 500000000LL)
+		return deadline + (long)((1000000000LL - rem + 999999) / 1000000);
+	return deadline - (long)(rem / 1000000);
+#endif
+}
+
+void scheduler_push(struct scheduler *sched, struct run_instance *run, long deadline) {
+	if (unlikely(sched->size == sched->capacity)) {
+		sched->capacity = sched->capacity ? sched->capacity * 2 : 16;
+		sched->heap = realloc(sched->heap, sizeof(struct scheduler_entry) * sched->capacity);
+	}
+	struct scheduler_entry *const heap = sched->heap;
+	unsigned pos = sched->size++;
+	for (; pos > 0 && heap[(pos - 1) / 2].deadline > deadline; pos = (pos - 1) / 2)
+		heap[pos] = heap[(pos - 1) / 2];
+	heap[pos] = (struct scheduler_entry){deadline, run};
+}
+
+struct run_instance *scheduler_pop_due(struct scheduler *sched, long now, long *deadline) {
+	if (sched->size == 0 || sched->heap[0].deadline > now)
+		return NULL;
+	struct scheduler_entry *const heap = sched->heap;
+	struct run_instance *const res = heap[0].run;
+	*deadline = heap[0].deadline;
+
+	const struct scheduler_entry last = heap[--sched->size];
+	unsigned pos = 0;
+	for (unsigned child; (child = 2 * pos + 1) < sched->size; pos = child) {
+		if (child + 1 < sched->size && heap[child + 1].deadline < heap[child].deadline)
+			++child;
+		if (last.deadline <= heap[child].deadline)
+			break;
+		heap[pos] = heap[child];
+	}
+	heap[pos] = last;
+	return res;
+}
+
+void scheduler_free(struct scheduler *sched) {
+	free(sched->heap);
+	*sched = (struct scheduler){0};
+}
+
+#ifdef TESTS
+
+int test_scheduler(void) {
+	enum { COUNT = 1000 };
+	struct run_instance *const runs = calloc(COUNT, sizeof(struct run_instance));
+	struct scheduler sched = {0};
+	for (unsigned i = 0; i < COUNT; ++i)
+		scheduler_push(&sched, runs + i, (long)((i * 7919) % COUNT));
+
+	bool res = true;
+	long prev = -1, deadline;
+	struct run_instance *run;
+	if (scheduler_pop_due(&sched, -1, &deadline) != NULL)
+		res = false;
+	for (unsigned i = 0; res && i < COUNT; ++i) {
+		res = (NULL != (run = scheduler_pop_due(&sched, COUNT, &deadline))) &&
+				deadline >= prev && deadline == (long)(((unsigned)(run - runs) * 7919) % COUNT);
+		prev = deadline;
+	}
+	if (res && scheduler_next_deadline(&sched) != -1)
+		res = false;
+	scheduler_free(&sched);
+	free(runs);
+	if (!res) {
+		fprintf(stderr, "test_scheduler: deadlines aren't popped in order\n");
+		return res;
+	}
+
+	const long now = monotonic_ms();
+	for (long i = 0; res && i < 2000; ++i) { // an aligned deadline must stay put when aligned again
+		const long aligned = scheduler_align_second(now + i);
+		const long again = scheduler_align_second(aligned);
+		res = aligned - (now + i) >= -500 && aligned - (now + i) <= 501 && again - aligned >= -1 && again - aligned <= 1;
+	}
+	if (!res)
+		fprintf(stderr, "test_scheduler: deadlines aren't aligned to the nearest second\n");
+	return res;
+}
+
+#endif
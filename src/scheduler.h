@@ -0,0 +1,71 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+
+struct run_instance;
+
+/**
+ * @brief min-heap of blocks' absolute deadlines, in CLOCK_MONOTONIC milliseconds
+ */
+struct scheduler {
+	struct scheduler_entry {
+		long deadline;
+		struct run_instance *run;
+	} *heap;
+	unsigned size;
+	unsigned capacity;
+};
+
+long monotonic_ms(void);
+/**
+ * @brief scheduler_align_second move @arg deadline to the nearest wall-clock second boundary
+ *
+ * So blocks with whole second intervals, like date, refresh right as the
+ * second changes, and wake up together.
+ */
+long scheduler_align_second(long deadline);
+
+void scheduler_push(struct scheduler *sched, struct run_instance *run, long deadline);
+/**
+ * @brief scheduler_pop_due remove the earliest block if its deadline has passed
+ *
+ * @param deadline output of the removed block's deadline
+ * @return the removed block, or NULL if no deadline has passed
+ */
+struct run_instance *scheduler_pop_due(struct scheduler *sched, long now, long *deadline);
+/**
+ * @brief scheduler_next_deadline get the earliest deadline
+ *
+ * @return the deadline, or -1 if no block is scheduled
+ */
+static inline long scheduler_next_deadline(const struct scheduler *sched) {
+	return sched->size ? sched->heap[0].deadline : -1;
+}
+static inline void scheduler_clear(struct scheduler *sched) {
+	sched->size = 0;
+}
+void scheduler_free(struct scheduler *sched);
+
+#ifdef TESTS
+int test_scheduler(void);
+#endif
+
+#endif // SCHEDULER_H
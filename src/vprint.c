@@ -26,7 +26,40 @@ static void vprint_ch(struct vprint *ctx, char ch) {
 	ctx->buffer_start += 1;
 }
 
+static bool vprint_is_option(const struct vprint *ctx, uint8_t n) {
+	return (n < 0x80) && (ctx->var_options[n >> 5] & (1 << (n & 0x1F)));
+}
+
+/**
+ * @brief vprint_pad pad output of last option to its requested width, counting UTF-8 characters
+ */
+static void vprint_pad(struct vprint *ctx) {
+	const bool left = ctx->pad_width < 0;
+	const size_t width = (size_t)(left ? -ctx->pad_width : ctx->pad_width);
+	ctx->pad_width = 0;
+
+	const size_t len = (size_t)(ctx->buffer_start - ctx->pad_start);
+	size_t chars = 0;
+	for (size_t i = 0; i < len; ++i)
+		chars += ((ctx->pad_start[i] & 0xC0) != 0x80);
+	if (chars >= width)
+		return;
+	const size_t pad = width - chars;
+	if (ctx->buffer_start + pad >= ctx->buffer_end)
+		return;
+	if (left)
+		memset(ctx->buffer_start, ' ', pad);
+	else {
+		memmove(ctx->pad_start + pad, ctx->pad_start, len);
+		memset(ctx->pad_start, ' ', pad);
+	}
+	ctx->buffer_start += pad;
+	ctx->buffer_start[0] = '\0';
+}
+
 unsigned vprint_walk(struct vprint *ctx) {
+	if (ctx->pad_width != 0)
+		vprint_pad(ctx);
 	const char *next = strchr(ctx->curr_pos, '%');
 	if (!next) {
 		vprint_strcat(ctx, ctx->curr_pos);
@@ -38,10 +71,32 @@ unsigned vprint_walk(struct vprint *ctx) {
 	memcpy(ctx->buffer_start, ctx->curr_pos, len);
 	ctx->buffer_start[len] = '\0';
 	ctx->buffer_start += len;
-	ctx->curr_pos += len + 2;
-	const uint8_t n = (uint8_t)(*(next + 1));
-	if ((n < 0x80) && (ctx->var_options[n >> 5] & (1 << (n & 0x1F))))
+
+	const char *spec = next + 1;
+	int width = 0;
+	if (!vprint_is_option(ctx, (uint8_t)*spec)) {
+		const bool left = (*spec == '-');
+		if (left)
+			++spec;
+		const char *digits = spec;
+		for (; *spec >= '0' && *spec <= '9'; ++spec);
+		if (!vprint_is_option(ctx, (uint8_t)*spec) && spec != digits && vprint_is_option(ctx, (uint8_t)spec[-1]))
+			--spec; // last digit is the option itself, like "%-5" for option '5'
+		for (const char *iter = digits; iter != spec; ++iter)
+			if (width < VPRINT_MAX_WIDTH)
+				width = width * 10 + (*iter - '0');
+		if (width > VPRINT_MAX_WIDTH)
+			width = VPRINT_MAX_WIDTH;
+		if (left)
+			width = -width;
+	}
+	ctx->curr_pos = spec + 1;
+	const uint8_t n = (uint8_t)(*spec);
+	if (vprint_is_option(ctx, n)) {
+		ctx->pad_start = ctx->buffer_start;
+		ctx->pad_width = width;
 		return n;
+	}
 	if (n == '%') {
 		vprint_ch(ctx, '%');
 		return vprint_walk(ctx);
@@ -151,6 +206,48 @@ _out:
 	return base * atoll(str);
 }
 
+#ifdef TESTS
+
+int test_vprint_width(void) {
+	// generated using command ./scripts/gen-format.py 1au
+	VPRINT_OPTS(test_var_options, {0x00000000, 0x00020000, 0x00000000, 0x00200002});
+	static const struct {
+		const char *format;
+		const char *expected;
+	} tests[] = {
+		{"[%u]", "[42]"},
+		{"[%5u]", "[   42]"},
+		{"[%-5u]", "[42   ]"},
+		{"[%1u]", "[oneu]"}, // '1' is an option, so not a width
+		{"[%51]", "[  one]"}, // last digit is the option
+		{"[%-51]", "[one  ]"},
+		{"[%2a]", "[ \xC3\xA9]"}, // UTF-8 characters are counted once
+		{"%-3a|%3u%%", "\xC3\xA9  | 42%"},
+		{"[%999u]", NULL}, // clamped to VPRINT_MAX_WIDTH
+	};
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+		char buffer[128];
+		struct vprint ctx = VPRINT_INIT(test_var_options, tests[i].format, buffer);
+		unsigned res;
+		while ((res = vprint_walk(&ctx)) != 0) {
+			switch (res) {
+				case '1': vprint_strcat(&ctx, "one"); break;
+				case 'a': vprint_strcat(&ctx, "\xC3\xA9"); break;
+				case 'u': vprint_itoa(&ctx, 42); break;
+			}
+		}
+		const bool ok = tests[i].expected ? (0 == strcmp(buffer, tests[i].expected)) :
+				(strlen(buffer) == VPRINT_MAX_WIDTH + 2);
+		if (!ok) {
+			fprintf(stderr, "test_vprint_width: format [%s] resulted in [%s]\n", tests[i].format, buffer);
+			return false;
+		}
+	}
+	return true;
+}
+
+#endif
+
 #if 0
 void vprint_collect_used(const char *str, uint32_t var_options[8]) {
 	while ((str = strchr(str, '%'))) {
@@ -27,12 +27,22 @@ struct vprint {
 	const char *curr_pos; ///< output format
 	char *buffer_start; ///< char[] buffer for output
 	char *buffer_end; ///< ptr to end of buffer, for ex. `buffer + sizeof(buffer)`
+
+	char *pad_start; ///< start of last variable's output
+	int pad_width; ///< requested width of last variable, negative for left alignment
 };
 #define VPRINT_OPTS(name, ...) static const uint32_t name[4] = __VA_ARGS__
+/// initialize vprint instance with output into char[] @arg buffer
+#define VPRINT_INIT(var_options, format, buffer) {(var_options), (format), (buffer), (buffer) + sizeof(buffer), NULL, 0}
+#define VPRINT_MAX_WIDTH 64
 
 /**
  * @brief vprint_walk traverse the vprint instance until the end
  *
+ * An option can have a width, like "%5u" (right aligned) or "%-5u" (left
+ * aligned), in which case its output is padded with spaces on next walk. If
+ * the character after the `%` is itself an option, it is never a width.
+ *
  * @param ctx the vprint instance
  * @return zero if needs to stop the traversing (end of format, no enough buffer, incorrect option), else
  * returns the current option (for example for "%s" will return 's').
@@ -46,6 +56,10 @@ void vprint_time(struct vprint *ctx, int value);
 void vprint_human_bytes(struct vprint *ctx, uint64_t value, uint64_t pct_base, uint64_t val_bsize, bool use_decimal);
 long parse_human_bytes(const char *str);
 
+#ifdef TESTS
+int test_vprint_width(void);
+#endif
+
 #if 0
 void vprint_collect_used(const char *str, uint32_t var_options[8]);
 #endif
@@ -0,0 +1,370 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "worker_pool.h"
+#include "main.h"
+#include "ini_parser.h"
+#include "fdpoll.h"
+#include "budget.h"
+#include "scheduler.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define WORKER_POOL_SIZE 2
+#define WORKER_STALE_TEXT "timeout"
+
+struct worker_job {
+	struct run_instance *run; ///< NULL to stop the worker
+	bool changed;
+};
+
+/**
+ * @brief lock-free single producer single consumer ring of jobs
+ */
+struct worker_queue {
+	struct worker_job *items;
+	unsigned mask; ///< capacity - 1, capacity is a power of 2
+	atomic_uint head; ///< next item to pop, written only by the consumer
+	atomic_uint tail; ///< next item to push, written only by the producer
+};
+
+static void worker_queue_init(struct worker_queue *q, unsigned min_capacity) {
+	unsigned capacity = 1;
+	while (capacity < min_capacity)
+		capacity <<= 1;
+	q->items = (struct worker_job *)malloc(sizeof(struct worker_job) * capacity);
+	q->mask = capacity - 1;
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+}
+
+static bool worker_queue_push(struct worker_queue *q, struct worker_job job) {
+	const unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	if (unlikely(tail - atomic_load_explicit(&q->head, memory_order_acquire) > q->mask))
+		return false;
+	q->items[tail & q->mask] = job;
+	atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+static bool worker_queue_pop(struct worker_queue *q, struct worker_job *job) {
+	const unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	if (head == atomic_load_explicit(&q->tail, memory_order_acquire))
+		return false;
+	*job = q->items[head & q->mask];
+	atomic_store_explicit(&q->head, head + 1, memory_order_release);
+	return true;
+}
+
+struct worker {
+	pthread_t thread;
+	int wake_fd; ///< eventfd signaled when jobs were pushed
+	unsigned pending; ///< jobs submitted and not yet returned, used only by main thread
+	struct worker_queue jobs; ///< main thread -> worker
+	struct worker_queue results; ///< worker -> main thread
+};
+
+struct worker_block {
+	struct run_instance *run;
+	long timeout;
+	long deadline; ///< when the running recache times out
+	bool expired; ///< the running recache timed out, and the block is shown as stale
+	struct cmd_data_base stale; ///< placeholder shown while no result is available
+	char stale_text[256];
+};
+
+static struct {
+	struct worker workers[WORKER_POOL_SIZE];
+	unsigned workers_count;
+	struct worker_block *blocks;
+	unsigned blocks_count;
+	int result_fd; ///< eventfd signaled by workers when results were pushed
+} g_worker_pool = {.workers_count = 0, .blocks = NULL, .blocks_count = 0, .result_fd = -1};
+
+static void *worker_main(void *arg) {
+	struct worker *w = arg;
+	while (true) {
+		uint64_t count;
+		if (unlikely(0 > read(w->wake_fd, &count, sizeof(count))) && errno != EINTR)
+			return NULL;
+		struct worker_job job;
+		while (worker_queue_pop(&w->jobs, &job)) {
+			if (unlikely(!job.run))
+				return NULL;
+			job.changed = budget_recache(job.run);
+			worker_queue_push(&w->results, job); // can't be full, as every block is queued at most once
+			const uint64_t one = 1;
+			if (unlikely(sizeof(one) != write(g_worker_pool.result_fd, &one, sizeof(one))))
+				fprintf(stderr, "worker_pool: unable to signal result: %s\n", strerror(errno));
+		}
+	}
+}
+
+static struct worker_block *worker_pool_find(const struct run_instance *run) {
+	for (unsigned i = 0; i < g_worker_pool.blocks_count; i++)
+		if (g_worker_pool.blocks[i].run == run)
+			return g_worker_pool.blocks + i;
+	return NULL;
+}
+
+/**
+ * @brief worker_block_snapshot keep a copy of the current output, to show it when stale
+ */
+static void worker_block_snapshot(struct worker_block *block) {
+	const struct cmd_data_base *data = block->run->data;
+	const char *text = data->cached_fulltext ? data->cached_fulltext : "";
+	size_t len = data->cached_fulltext ? data->cached_fulltext_len : 0;
+	if (len == 0) {
+		text = WORKER_STALE_TEXT;
+		len = X_STRLEN(WORKER_STALE_TEXT);
+	} else if (len >= sizeof(block->stale_text)) {
+		len = sizeof(block->stale_text) - 1;
+		while (len > 0 && (text[len] & 0xC0) == 0x80) // don't cut an UTF-8 character
+			len--;
+	}
+	memcpy(block->stale_text, text, len);
+	block->stale_text[len] = '\0';
+	block->stale.cached_fulltext_len = (unsigned)len;
+}
+
+static bool worker_pool_handle_results(void *arg) {
+	(void)arg;
+	uint64_t count;
+	if (unlikely(0 > read(g_worker_pool.result_fd, &count, sizeof(count))))
+		return false;
+	for (unsigned i = 0; i < g_worker_pool.workers_count; i++) {
+		struct worker *const w = g_worker_pool.workers + i;
+		struct worker_job job;
+		while (worker_queue_pop(&w->results, &job)) {
+			struct run_instance *const run = job.run;
+			w->pending--;
+			run->busy = false;
+			if (run->placeholder) { // restore the real output
+				run->placeholder = NULL;
+				job.changed = true;
+			}
+			run->data->dirty |= job.changed;
+			cmd_adapt_interval(run->data, job.changed);
+			budget_charge(run, monotonic_ms());
+			struct worker_block *const block = worker_pool_find(run);
+			block->expired = false;
+			worker_block_snapshot(block);
+		}
+	}
+	return false;
+}
+
+bool worker_pool_init(struct runs_list *runs) {
+	FOREACH_RUN(run, runs)
+		if (run->vtable->recache_blocking)
+			g_worker_pool.blocks_count++;
+	if (g_worker_pool.blocks_count == 0)
+		return true;
+
+	g_worker_pool.blocks = (struct worker_block *)calloc(g_worker_pool.blocks_count, sizeof(struct worker_block));
+	struct worker_block *block = g_worker_pool.blocks;
+	FOREACH_RUN(run, runs) {
+		if (!run->vtable->recache_blocking)
+			continue;
+		block->run = run;
+		block->timeout = run->data->timeout > 0 ? run->data->timeout : run->data->interval;
+		if (block->timeout <= 0)
+			block->timeout = g_general_settings.interval;
+		memcpy(block->stale_text, WORKER_STALE_TEXT, sizeof(WORKER_STALE_TEXT));
+		block->stale.cached_fulltext = block->stale_text;
+		block->stale.cached_fulltext_len = 0; // shown empty until the first result, or until it times out
+		block->stale.dirty = true;
+		run->placeholder = &block->stale;
+		block++;
+	}
+
+	g_worker_pool.result_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (unlikely(g_worker_pool.result_fd < 0)) {
+		fprintf(stderr, "worker_pool: eventfd failed with %s\n", strerror(errno));
+		return false;
+	}
+	fdpoll_add(g_worker_pool.result_fd, worker_pool_handle_results, NULL);
+
+	// workers inherit the blocked signals, so signals are left for main thread's signalfd
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	const unsigned count = g_worker_pool.blocks_count < WORKER_POOL_SIZE ? g_worker_pool.blocks_count : WORKER_POOL_SIZE;
+	for (; g_worker_pool.workers_count < count; g_worker_pool.workers_count++) {
+		struct worker *const w = g_worker_pool.workers + g_worker_pool.workers_count;
+		w->pending = 0;
+		worker_queue_init(&w->jobs, g_worker_pool.blocks_count + 1); // place for stop job
+		worker_queue_init(&w->results, g_worker_pool.blocks_count);
+		if (unlikely(0 > (w->wake_fd = eventfd(0, EFD_CLOEXEC)))) {
+			fprintf(stderr, "worker_pool: eventfd failed with %s\n", strerror(errno));
+			break;
+		}
+		const int r = pthread_create(&w->thread, NULL, worker_main, w);
+		if (unlikely(r != 0)) {
+			fprintf(stderr, "worker_pool: pthread_create failed with %s\n", strerror(r));
+			close(w->wake_fd);
+			break;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return g_worker_pool.workers_count == count;
+}
+
+bool worker_pool_submit(struct run_instance *run, long now) {
+	struct worker_block *const block = worker_pool_find(run);
+	if (unlikely(!block) || run->busy)
+		return false;
+	struct worker *w = g_worker_pool.workers;
+	for (unsigned i = 1; i < g_worker_pool.workers_count; i++) // prefer idle workers over stuck ones
+		if (g_worker_pool.workers[i].pending < w->pending)
+			w = g_worker_pool.workers + i;
+
+	run->busy = true;
+	block->deadline = now + block->timeout;
+	w->pending++;
+	worker_queue_push(&w->jobs, (struct worker_job){.run = run, .changed = false});
+	const uint64_t one = 1;
+	if (unlikely(sizeof(one) != write(w->wake_fd, &one, sizeof(one))))
+		fprintf(stderr, "worker_pool: unable to wake worker: %s\n", strerror(errno));
+	return true;
+}
+
+bool worker_pool_expire(long now) {
+	bool expired = false;
+	for (unsigned i = 0; i < g_worker_pool.blocks_count; i++) {
+		struct worker_block *const block = g_worker_pool.blocks + i;
+		if (block->run->busy && !block->expired && block->deadline <= now) {
+			if (block->stale.cached_fulltext_len == 0) // the first recache is stuck
+				block->stale.cached_fulltext_len = X_STRLEN(WORKER_STALE_TEXT);
+			cmd_cache_color(block->stale.cached_color, g_general_settings.color_bad);
+			block->stale.dirty = true;
+			block->run->placeholder = &block->stale;
+			block->expired = true;
+			expired = true;
+		}
+	}
+	return expired;
+}
+
+long worker_pool_next_deadline(void) {
+	long deadline = -1;
+	for (unsigned i = 0; i < g_worker_pool.blocks_count; i++) {
+		const struct worker_block *const block = g_worker_pool.blocks + i;
+		if (block->run->busy && !block->expired && (deadline < 0 || block->deadline < deadline))
+			deadline = block->deadline;
+	}
+	return deadline;
+}
+
+void worker_pool_free(void) {
+	bool stuck = false;
+	for (unsigned i = 0; i < g_worker_pool.workers_count; i++) {
+		struct worker *const w = g_worker_pool.workers + i;
+		const uint64_t one = 1;
+		worker_queue_push(&w->jobs, (struct worker_job){.run = NULL, .changed = false});
+		if (sizeof(one) == write(w->wake_fd, &one, sizeof(one)) && w->pending == 0) {
+			pthread_join(w->thread, NULL);
+			close(w->wake_fd);
+			free(w->jobs.items);
+			free(w->results.items);
+		} else { // stuck inside a recache, so leave it the resources it uses
+			pthread_detach(w->thread);
+			stuck = true;
+		}
+	}
+	g_worker_pool.workers_count = 0;
+	if (g_worker_pool.result_fd >= 0) {
+		fdpoll_remove(g_worker_pool.result_fd);
+		if (!stuck)
+			close(g_worker_pool.result_fd);
+	}
+	free(g_worker_pool.blocks);
+	g_worker_pool.blocks = NULL;
+	g_worker_pool.blocks_count = 0;
+}
+
+#ifdef TESTS
+
+#define TEST_QUEUE_ITEMS 100000
+
+static void *test_worker_queue_producer(void *arg) {
+	struct worker_queue *q = arg;
+	for (uintptr_t i = 1; i <= TEST_QUEUE_ITEMS; ) {
+		if (worker_queue_push(q, (struct worker_job){.run = (struct run_instance *)i, .changed = (i & 1)}))
+			i++;
+		else
+			sched_yield();
+	}
+	return NULL;
+}
+
+int test_worker_queue(void) {
+#define TEST_ERR(...) ((void)fprintf(stderr, __VA_ARGS__), false)
+#define ERR_STR(str) "test_worker_queue: "str"\n"
+	struct worker_queue q;
+	struct worker_job job;
+	worker_queue_init(&q, 3);
+	if (q.mask != 3)
+		return TEST_ERR(ERR_STR("capacity %u isn't rounded to power of 2"), q.mask + 1);
+	for (uintptr_t round = 0; round < 10; round++) { // wraps around the ring
+		for (uintptr_t i = 0; i < 4; i++)
+			if (!worker_queue_push(&q, (struct worker_job){.run = (struct run_instance *)(round * 4 + i + 1)}))
+				return TEST_ERR(ERR_STR("push into non full queue failed"));
+		if (worker_queue_push(&q, (struct worker_job){.run = NULL}))
+			return TEST_ERR(ERR_STR("push into full queue succeeded"));
+		for (uintptr_t i = 0; i < 4; i++)
+			if (!worker_queue_pop(&q, &job) || job.run != (struct run_instance *)(round * 4 + i + 1))
+				return TEST_ERR(ERR_STR("round %lu: popped wrong item %lu"), (unsigned long)round, (unsigned long)i);
+		if (worker_queue_pop(&q, &job))
+			return TEST_ERR(ERR_STR("pop from empty queue succeeded"));
+	}
+	free(q.items);
+
+	worker_queue_init(&q, 16);
+	pthread_t producer;
+	if (0 != pthread_create(&producer, NULL, test_worker_queue_producer, &q))
+		return TEST_ERR(ERR_STR("pthread_create failed"));
+	for (uintptr_t i = 1; i <= TEST_QUEUE_ITEMS; ) {
+		if (!worker_queue_pop(&q, &job)) {
+			sched_yield();
+			continue;
+		}
+		if (job.run != (struct run_instance *)i || job.changed != (bool)(i & 1)) {
+			pthread_join(producer, NULL);
+			return TEST_ERR(ERR_STR("concurrent pop got %lu instead of %lu"), (unsigned long)(uintptr_t)job.run, (unsigned long)i);
+		}
+		i++;
+	}
+	pthread_join(producer, NULL);
+	free(q.items);
+	return true;
+#undef ERR_STR
+#undef TEST_ERR
+}
+
+#endif
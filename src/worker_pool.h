@@ -0,0 +1,63 @@
+/*
+ * This file is part of is3-status (https://github.com/arthurzam/is3-status).
+ * Copyright (C) 2019  Arthur Zamarin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stdbool.h>
+
+struct run_instance;
+struct runs_list;
+
+/**
+ * @brief worker_pool_init start the worker threads, if any block has a blocking recache
+ *
+ * Must be called after func_init of all blocks, and before the first
+ * worker_pool_submit().
+ *
+ * @return false if the threads couldn't be started
+ */
+bool worker_pool_init(struct runs_list *runs);
+/**
+ * @brief worker_pool_submit run the recache of @arg run on a worker thread
+ *
+ * Until the result arrives, run->busy is set and the block's data mustn't
+ * be touched. If it doesn't arrive in the block's timeout, the block is
+ * shown as stale using its placeholder.
+ *
+ * @return false if the block is still busy with a previous recache
+ */
+bool worker_pool_submit(struct run_instance *run, long now);
+/**
+ * @brief worker_pool_expire show the blocks whose recache passed its timeout as stale
+ *
+ * @return true if any block became stale
+ */
+bool worker_pool_expire(long now);
+/**
+ * @brief worker_pool_next_deadline get the earliest timeout of a busy block
+ *
+ * @return the deadline, or -1 if no block is busy
+ */
+long worker_pool_next_deadline(void);
+void worker_pool_free(void);
+
+#ifdef TESTS
+int test_worker_queue(void);
+#endif
+
+#endif // WORKER_POOL_H